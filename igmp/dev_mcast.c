@@ -40,6 +40,7 @@
 #include <linux/skbuff.h>
 #include "sock.h"
 #include "arp.h"
+#include "dev_mcast.h"
 
 
 /*
@@ -53,14 +54,501 @@
  */
  
 
+/*
+ *	Address index. Each dev_mc_list entry is the front of a dev_mc_node
+ *	which also chains it into a hash on (device, address) and remembers
+ *	the link pointing at it in dev->mc_list, so add and delete don't
+ *	compare against every address on the device. The bucket array starts
+ *	small and doubles with the number of entries.
+ *
+ *	Drivers and the upload timer read the list and the packed array
+ *	without locks. The changes all come from process context and are
+ *	made with interrupts off, so readers see them whole.
+ */
+
+struct dev_mc_node
+{
+	struct dev_mc_list dmi;		/* Must be first */
+	struct dev_mc_node *hash_next;
+	struct dev_mc_list **pprev;	/* Link that points at us */
+	struct device *dev;
+	int slot;			/* Index in the packed upload array */
+};
+
+#define DEV_MC_NODE(dmi)	((struct dev_mc_node *)(dmi))
+
+#define DEV_MC_HASH_MIN		64
+#define DEV_MC_HASH_MAX		16384	/* Keep the buckets in one kmalloc */
+
+static struct dev_mc_node *dev_mc_hash_min[DEV_MC_HASH_MIN];
+static struct dev_mc_node **dev_mc_hash=dev_mc_hash_min;
+static unsigned int dev_mc_hash_size=DEV_MC_HASH_MIN;
+static unsigned int dev_mc_hash_count=0;
+
+static inline unsigned int dev_mc_hashfn(struct device *dev, void *addr, int alen, unsigned int size)
+{
+	unsigned char *p=(unsigned char *)addr;
+	unsigned long h=(unsigned long)dev>>4;
+	while(alen--)
+		h=(h<<5)+h+*p++;
+	h^=h>>16;
+	return h&(size-1);
+}
+
+static struct dev_mc_list *dev_mc_find(struct device *dev, void *addr, int alen)
+{
+	struct dev_mc_node *n=dev_mc_hash[dev_mc_hashfn(dev,addr,alen,dev_mc_hash_size)];
+	for(;n!=NULL;n=n->hash_next)
+		if(n->dev==dev && n->dmi.dmi_addrlen==alen && memcmp(n->dmi.dmi_addr,addr,alen)==0)
+			return &n->dmi;
+	return NULL;
+}
+
+/*
+ *	Double the bucket array. If the memory isn't there we just carry
+ *	on with longer chains.
+ */
+ 
+static void dev_mc_hash_grow(void)
+{
+	struct dev_mc_node **nh, **oh, *n, *next;
+	unsigned int size=dev_mc_hash_size*2;
+	unsigned int i, h;
+	unsigned long flags;
+	
+	nh=(struct dev_mc_node **)kmalloc(size*sizeof(*nh), GFP_KERNEL);
+	if(nh==NULL)
+		return;
+	/* Someone else may have grown it while we slept */
+	if(dev_mc_hash_size*2!=size)
+	{
+		kfree_s(nh,size*sizeof(*nh));
+		return;
+	}
+	memset(nh,0,size*sizeof(*nh));
+	save_flags(flags);
+	cli();
+	for(i=0;i<dev_mc_hash_size;i++)
+	{
+		for(n=dev_mc_hash[i];n!=NULL;n=next)
+		{
+			next=n->hash_next;
+			h=dev_mc_hashfn(n->dev,n->dmi.dmi_addr,n->dmi.dmi_addrlen,size);
+			n->hash_next=nh[h];
+			nh[h]=n;
+		}
+	}
+	oh=dev_mc_hash;
+	dev_mc_hash=nh;
+	dev_mc_hash_size=size;
+	restore_flags(flags);
+	if(oh!=dev_mc_hash_min)
+		kfree_s(oh,(size/2)*sizeof(*oh));
+}
+
+static void dev_mc_link(struct device *dev, struct dev_mc_list *dmi)
+{
+	struct dev_mc_node *n=DEV_MC_NODE(dmi);
+	unsigned long flags;
+	unsigned int h;
+	
+	n->dev=dev;
+	save_flags(flags);
+	cli();
+	dmi->next=dev->mc_list;
+	if(dmi->next!=NULL)
+		DEV_MC_NODE(dmi->next)->pprev=&dmi->next;
+	n->pprev=&dev->mc_list;
+	dev->mc_list=dmi;
+	h=dev_mc_hashfn(dev,dmi->dmi_addr,dmi->dmi_addrlen,dev_mc_hash_size);
+	n->hash_next=dev_mc_hash[h];
+	dev_mc_hash[h]=n;
+	dev_mc_hash_count++;
+	restore_flags(flags);
+}
+
+static void dev_mc_unlink(struct dev_mc_list *dmi)
+{
+	struct dev_mc_node *n=DEV_MC_NODE(dmi);
+	struct dev_mc_node **np;
+	unsigned long flags;
+	
+	save_flags(flags);
+	cli();
+	*n->pprev=dmi->next;
+	if(dmi->next!=NULL)
+		DEV_MC_NODE(dmi->next)->pprev=n->pprev;
+	np=&dev_mc_hash[dev_mc_hashfn(n->dev,dmi->dmi_addr,dmi->dmi_addrlen,dev_mc_hash_size)];
+	for(;*np!=NULL;np=&(*np)->hash_next)
+	{
+		if(*np==n)
+		{
+			*np=n->hash_next;
+			break;
+		}
+	}
+	dev_mc_hash_count--;
+	restore_flags(flags);
+}
+
+/*
+ *	Node arenas. Blocks a little under a page are cut into objects
+ *	aligned to a (486) cache line. Freed objects go on a free list and
+ *	the blocks are only handed back when the arena empties or is
+ *	released as a whole.
+ */
+
+#define MC_ARENA_ALIGN		16
+#define MC_ARENA_CHUNK		4000	/* Fits a page with kmalloc's header */
+
+void mc_arena_init(struct mc_arena *a, int size)
+{
+	a->chunks=NULL;
+	a->free=NULL;
+	a->size=(size+MC_ARENA_ALIGN-1)&~(MC_ARENA_ALIGN-1);
+	a->inuse=0;
+	a->nchunks=0;
+}
+
+static int mc_arena_grow(struct mc_arena *a, int priority)
+{
+	void **chunk=(void **)kmalloc(MC_ARENA_CHUNK, priority);
+	unsigned long p, end;
+	
+	if(chunk==NULL)
+		return -ENOMEM;
+	*chunk=a->chunks;
+	a->chunks=chunk;
+	a->nchunks++;
+	p=((unsigned long)(chunk+1)+MC_ARENA_ALIGN-1)&~(MC_ARENA_ALIGN-1);
+	end=(unsigned long)chunk+MC_ARENA_CHUNK;
+	for(;p+a->size<=end;p+=a->size)
+	{
+		*(void **)p=a->free;
+		a->free=(void *)p;
+	}
+	return 0;
+}
+
+void *mc_arena_alloc(struct mc_arena *a, int priority)
+{
+	void **obj;
+	
+	if(a->free==NULL && mc_arena_grow(a,priority)<0)
+		return NULL;
+	obj=(void **)a->free;
+	a->free=*obj;
+	a->inuse++;
+	return obj;
+}
+
+void mc_arena_release(struct mc_arena *a)
+{
+	void **chunk;
+	
+	while(a->chunks!=NULL)
+	{
+		chunk=(void **)a->chunks;
+		a->chunks=*chunk;
+		kfree_s(chunk,MC_ARENA_CHUNK);
+	}
+	a->free=NULL;
+	a->inuse=0;
+	a->nchunks=0;
+}
+
+void mc_arena_free(struct mc_arena *a, void *obj)
+{
+	*(void **)obj=a->free;
+	a->free=obj;
+	if(--a->inuse==0)
+		mc_arena_release(a);
+}
+
+/*
+ *	Per device upload state. List changes can be held back, either
+ *	between dev_mc_batch_begin and dev_mc_batch_end or for a short
+ *	per device delay on the device's own timer, so that a burst of joins
+ *	reprograms the NIC once rather than once per address. Devices that
+ *	ask for neither upload on every change as before.
+ *
+ *	The state also keeps the addresses packed in the layout the drivers
+ *	want. Adds append, deletes move the last address into the hole, so
+ *	an upload hands over the array as it stands.
+ *
+ *	Alongside the list we keep a 512 bucket hash of the addresses, using
+ *	the top bits of the Ethernet CRC as most hash filter chips do. A
+ *	driver folds it down to the size of its filter with
+ *	dev_mc_hash_filter instead of hashing the list itself. Past the per
+ *	device limit we stop sending the list and ask for all multicast.
+ *
+ *	The list entries themselves come from the state's node arena. The
+ *	state lives until dev_mc_discard.
+ */
+
+#define DEV_MC_HASH_BITS	512
+
+struct dev_mc_state
+{
+	struct dev_mc_state *next;
+	struct device *dev;
+	int batch;			/* Nesting depth of explicit batches */
+	int delay;			/* Jiffies to hold changes, 0 for none */
+	int pending;			/* NIC filter is out of date */
+	unsigned long uploads;		/* Calls to set_multicast_list */
+	unsigned long coalesced;	/* Changes folded into a later upload */
+	char *addrs;			/* Packed addresses, addr_len apart */
+	struct dev_mc_node **owner;	/* Entry stored in each slot */
+	int count;			/* Slots in use */
+	int size;			/* Slots allocated */
+	int packed;			/* addrs matches dev->mc_list */
+	int limit;			/* Most addresses to upload, 0 for no limit */
+	int allmulti;			/* Last upload asked for all multicast */
+	int allmulti_ok;		/* Driver understands DEV_MC_ALLMULTI */
+	int timer_running;		/* Holding changes back for delay */
+	struct timer_list timer;
+	unsigned short hash_count[DEV_MC_HASH_BITS];
+	unsigned char hash_filter[DEV_MC_HASH_BITS/8];
+	struct mc_arena nodes;		/* Where our dev_mc_nodes live */
+};
+
+#define DEV_MC_PACK_MIN		16
+
+static struct dev_mc_state *dev_mc_states=NULL;
+
+static void dev_mc_timer_expire(unsigned long data);
+
+/*
+ *	Ethernet CRC, most significant bit first. The top 9 bits pick the
+ *	hash bucket.
+ */
+ 
+static unsigned long dev_mc_crc(unsigned char *addr, int alen)
+{
+	unsigned long crc=0xFFFFFFFF;
+	int bit;
+	
+	while(alen--)
+	{
+		unsigned char c=*addr++;
+		for(bit=0;bit<8;bit++,c>>=1)
+		{
+			if(((crc>>31)^c)&1)
+				crc=(crc<<1)^0x04C11DB7;
+			else
+				crc<<=1;
+			crc&=0xFFFFFFFF;
+		}
+	}
+	return crc;
+}
+
+static void dev_mc_hash_add(struct dev_mc_state *st, struct dev_mc_list *dmi)
+{
+	int h=dev_mc_crc((unsigned char *)dmi->dmi_addr,dmi->dmi_addrlen)>>23;
+	if(st->hash_count[h]++==0)
+		st->hash_filter[h>>3]|=1<<(h&7);
+}
+
+static void dev_mc_hash_del(struct dev_mc_state *st, struct dev_mc_list *dmi)
+{
+	int h=dev_mc_crc((unsigned char *)dmi->dmi_addr,dmi->dmi_addrlen)>>23;
+	if(--st->hash_count[h]==0)
+		st->hash_filter[h>>3]&=~(1<<(h&7));
+}
+
+static struct dev_mc_state *dev_mc_state_find(struct device *dev)
+{
+	struct dev_mc_state *st;
+	for(st=dev_mc_states;st!=NULL;st=st->next)
+		if(st->dev==dev)
+			return st;
+	return NULL;
+}
+
+static struct dev_mc_state *dev_mc_state_get(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	struct dev_mc_state *new;
+	struct dev_mc_list *dmi;
+	if(st!=NULL)
+		return st;
+	new=(struct dev_mc_state *)kmalloc(sizeof(*new), GFP_KERNEL);
+	if(new==NULL)
+		return NULL;
+	st=dev_mc_state_find(dev);	/* In case we slept */
+	if(st!=NULL)
+	{
+		kfree_s(new,sizeof(*new));
+		return st;
+	}
+	st=new;
+	memset(st,0,sizeof(*st));
+	st->dev=dev;
+	st->packed=(dev->mc_count==0);	/* Else the first upload packs it */
+	mc_arena_init(&st->nodes,sizeof(struct dev_mc_node));
+	init_timer(&st->timer);
+	st->timer.function=&dev_mc_timer_expire;
+	st->timer.data=(unsigned long)st;
+	for(dmi=dev->mc_list;dmi!=NULL;dmi=dmi->next)
+		dev_mc_hash_add(st,dmi);
+	st->next=dev_mc_states;
+	dev_mc_states=st;
+	return st;
+}
+
+static void dev_mc_pack_free(struct dev_mc_state *st)
+{
+	char *addrs=st->addrs;
+	struct dev_mc_node **owner=st->owner;
+	int size=st->size;
+	unsigned long flags;
+	
+	save_flags(flags);
+	cli();
+	st->addrs=NULL;
+	st->owner=NULL;
+	st->count=0;
+	st->size=0;
+	restore_flags(flags);
+	if(size)
+	{
+		kfree_s(addrs,size*st->dev->addr_len);
+		kfree_s(owner,size*sizeof(*owner));
+	}
+}
+
+static int dev_mc_pack_resize(struct dev_mc_state *st, int size, int priority)
+{
+	int alen=st->dev->addr_len;
+	char *addrs, *oaddrs;
+	struct dev_mc_node **owner, **oowner;
+	int osize;
+	unsigned long flags;
+	
+	addrs=kmalloc(size*alen, priority);
+	if(addrs==NULL)
+		return -ENOMEM;
+	owner=(struct dev_mc_node **)kmalloc(size*sizeof(*owner), priority);
+	if(owner==NULL)
+	{
+		kfree_s(addrs,size*alen);
+		return -ENOMEM;
+	}
+	save_flags(flags);
+	cli();
+	/* We may have slept; someone else may have grown it already */
+	if(st->size>=size)
+	{
+		restore_flags(flags);
+		kfree_s(addrs,size*alen);
+		kfree_s(owner,size*sizeof(*owner));
+		return 0;
+	}
+	if(st->count)
+	{
+		memcpy(addrs,st->addrs,st->count*alen);
+		memcpy(owner,st->owner,st->count*sizeof(*owner));
+	}
+	oaddrs=st->addrs;
+	oowner=st->owner;
+	osize=st->size;
+	st->addrs=addrs;
+	st->owner=owner;
+	st->size=size;
+	restore_flags(flags);
+	if(osize)
+	{
+		kfree_s(oaddrs,osize*alen);
+		kfree_s(oowner,osize*sizeof(*oowner));
+	}
+	return 0;
+}
+
+/*
+ *	Give a new entry the next free slot. If the array can't grow we
+ *	drop it and let the next upload rebuild it from the list.
+ */
+ 
+static void dev_mc_pack_add(struct dev_mc_state *st, struct dev_mc_node *n)
+{
+	unsigned long flags;
+	if(!st->packed)
+		return;
+	if(st->count==st->size && dev_mc_pack_resize(st, st->size ? st->size*2 : DEV_MC_PACK_MIN, GFP_KERNEL)<0)
+	{
+		dev_mc_pack_free(st);
+		st->packed=0;
+		return;
+	}
+	save_flags(flags);
+	cli();
+	n->slot=st->count++;
+	st->owner[n->slot]=n;
+	memcpy(st->addrs+n->slot*st->dev->addr_len,n->dmi.dmi_addr,n->dmi.dmi_addrlen);
+	restore_flags(flags);
+}
+
+static void dev_mc_pack_del(struct dev_mc_state *st, struct dev_mc_node *n)
+{
+	int alen=st->dev->addr_len;
+	struct dev_mc_node *last;
+	unsigned long flags;
+	
+	if(!st->packed)
+		return;
+	save_flags(flags);
+	cli();
+	last=st->owner[--st->count];
+	if(last!=n)
+	{
+		memcpy(st->addrs+n->slot*alen,st->addrs+last->slot*alen,alen);
+		last->slot=n->slot;
+		st->owner[n->slot]=last;
+	}
+	restore_flags(flags);
+}
+
+/*
+ *	Pack the whole list again after an allocation failure.
+ */
+ 
+static int dev_mc_pack_rebuild(struct dev_mc_state *st, int priority)
+{
+	struct dev_mc_list *dmi;
+	int size=DEV_MC_PACK_MIN;
+	
+	dev_mc_pack_free(st);
+	/* The list can grow while we sleep for the array */
+	while(st->size<st->dev->mc_count || st->size==0)
+	{
+		while(size<st->dev->mc_count)
+			size*=2;
+		if(dev_mc_pack_resize(st,size,priority)<0)
+			return -ENOMEM;
+	}
+	for(dmi=st->dev->mc_list;dmi!=NULL;dmi=dmi->next)
+	{
+		struct dev_mc_node *n=DEV_MC_NODE(dmi);
+		n->slot=st->count++;
+		st->owner[n->slot]=n;
+		memcpy(st->addrs+n->slot*st->dev->addr_len,dmi->dmi_addr,dmi->dmi_addrlen);
+	}
+	st->packed=1;
+	return 0;
+}
+
 /*
  *	Update the multicast list into the physical NIC controller.
  */
  
 void dev_mc_upload(struct device *dev)
 {
-	struct dev_mc_list *dmi;
-	char *data, *tmp;
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+
+	/* Whatever happens below, nothing held back is still owed */
+	if(st!=NULL)
+		st->pending=0;
 
 	/* Don't do anything till we up the interface
 	   [dev_open will call this function so the list will
@@ -78,6 +566,8 @@ void dev_mc_upload(struct device *dev)
 	 * */
 	if(dev->set_multicast_list==NULL)
 		return;
+	if(st!=NULL)
+		st->uploads++;
 	/* Promiscuous is promiscuous - so no filter needed 
 	 *对于混杂模式，网络设备接受所有的数据包，无需进行数据包过滤设置。
 	 * */
@@ -87,6 +577,18 @@ void dev_mc_upload(struct device *dev)
 		return;
 	}
 	
+	/* Too many to list - take them all and let IP sort it out. Only
+	   drivers that asked for it get IFF_ALLMULTI passed on, the rest
+	   would go promiscuous */
+	if(st!=NULL)
+		st->allmulti=((st->limit && dev->mc_count>st->limit) ||
+			((dev->flags&IFF_ALLMULTI) && st->allmulti_ok));
+	if(st!=NULL && st->allmulti)
+	{
+		dev->set_multicast_list(dev, DEV_MC_ALLMULTI, NULL);
+		return;
+	}
+	
 	/*
 	 device结构中set_multicast_list指针指向的函数第二个参数表示多播地址个数，第三个参
 	 数表示具体的多播地址，这些地址紧密排列，set_multicast_list指向的函数将根据第二个
@@ -100,8 +602,8 @@ void dev_mc_upload(struct device *dev)
 		return;
 	}
 	
-	data=kmalloc(dev->mc_count*dev->addr_len, GFP_KERNEL);
-	if(data==NULL)
+	/* A delayed upload runs from the timer */
+	if(st==NULL || (!st->packed && dev_mc_pack_rebuild(st, intr_count ? GFP_ATOMIC : GFP_KERNEL)<0))
 	{
 		printk("Unable to get memory to set multicast list on %s\n",dev->name);
 		return;
@@ -113,36 +615,204 @@ void dev_mc_upload(struct device *dev)
 	 * 完成对新的设置的响应，这个过程中需要暂时停止网络设备的工作，在配置完成后，重新启
 	 * 动，从而使新的设置生效。具体的情况网络接收设备相关
 	 * */
-	for(tmp = data, dmi=dev->mc_list;dmi!=NULL;dmi=dmi->next)
+	dev->set_multicast_list(dev,dev->mc_count,st->addrs);
+}
+  
+/*
+ *	The list has changed. Upload now unless the device is holding
+ *	changes back.
+ */
+ 
+static void dev_mc_changed(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	
+	if(st==NULL || (st->batch==0 && st->delay==0))
+	{
+		dev_mc_upload(dev);
+		return;
+	}
+	if(st->pending)
+		st->coalesced++;
+	st->pending=1;
+	if(st->batch==0 && !st->timer_running)
 	{
-		memcpy(tmp,dmi->dmi_addr, dmi->dmi_addrlen);
-		tmp+=dev->addr_len;
+		st->timer.expires=st->delay;
+		st->timer_running=1;
+		add_timer(&st->timer);
 	}
-	dev->set_multicast_list(dev,dev->mc_count,data);
-	kfree(data);
 }
-  
+
 /*
- *	Delete a device level multicast
+ *	The hold-back window is over. Push the device unless it has gone
+ *	into an explicit batch meanwhile.
  */
  
-void dev_mc_delete(struct device *dev, void *addr, int alen, int all)
+static void dev_mc_timer_expire(unsigned long data)
+{
+	struct dev_mc_state *st=(struct dev_mc_state *)data;
+	st->timer_running=0;
+	if(st->pending && st->batch==0)
+		dev_mc_upload(st->dev);
+}
+
+/*
+ *	Hold back uploads until the matching dev_mc_batch_end. Batches
+ *	nest.
+ */
+ 
+int dev_mc_batch_begin(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->batch++;
+	return 0;
+}
+
+/*
+ *	As dev_mc_batch_begin, but only for a device that already has
+ *	state: it never allocates, so never sleeps, and a device with no
+ *	list yet has nothing to hold back.
+ */
+ 
+int dev_mc_batch_hold(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	if(st==NULL)
+		return -ENODEV;
+	st->batch++;
+	return 0;
+}
+
+void dev_mc_batch_end(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	if(st==NULL || st->batch==0)
+		return;
+	if(--st->batch==0 && st->pending)
+		dev_mc_upload(dev);
+}
+
+/*
+ *	Set how many jiffies list changes may be held back on a device.
+ *	Zero goes back to uploading on every change. Like the limit below
+ *	it holds until dev_mc_discard, and is set again when the device
+ *	comes back up.
+ */
+ 
+int dev_mc_set_delay(struct device *dev, int delay)
+{
+	struct dev_mc_state *st;
+	
+	if(delay<0)
+		return -EINVAL;
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->delay=delay;
+	if(delay==0 && st->pending && st->batch==0)
+		dev_mc_upload(dev);
+	return 0;
+}
+
+/*
+ *	Cap the number of addresses uploaded to a device. Past it the device
+ *	is asked for all multicast. Zero removes the cap.
+ */
+ 
+int dev_mc_set_limit(struct device *dev, int limit)
+{
+	struct dev_mc_state *st;
+	
+	if(limit<0)
+		return -EINVAL;
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->limit=limit;
+	dev_mc_changed(dev);
+	return 0;
+}
+
+/*
+ *	A driver that handles DEV_MC_ALLMULTI says so here, and is then
+ *	passed it for IFF_ALLMULTI instead of the list.
+ */
+ 
+int dev_mc_set_allmulti(struct device *dev, int ok)
 {
-	struct dev_mc_list **dmi;
-	for(dmi=&dev->mc_list;*dmi!=NULL;dmi=&(*dmi)->next)
+	struct dev_mc_state *st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->allmulti_ok=(ok!=0);
+	dev_mc_changed(dev);
+	return 0;
+}
+
+/*
+ *	For drivers: fill in a hash filter of 64, 128 or 512 bits for the
+ *	current list. Bit n of the filter is bit n&7 of byte n>>3, and n is
+ *	the top 6, 7 or 9 bits of the Ethernet CRC of the address.
+ */
+ 
+int dev_mc_hash_filter(struct device *dev, int bits, unsigned char *filter)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	int shift, i;
+	
+	switch(bits)
+	{
+		case 64:
+			shift=3;
+			break;
+		case 128:
+			shift=2;
+			break;
+		case 512:
+			shift=0;
+			break;
+		default:
+			return -EINVAL;
+	}
+	memset(filter,0,bits/8);
+	if(st==NULL)
+		return 0;
+	if(shift==0)
+	{
+		memcpy(filter,st->hash_filter,sizeof(st->hash_filter));
+		return 0;
+	}
+	for(i=0;i<DEV_MC_HASH_BITS;i++)
 	{
-		if(memcmp((*dmi)->dmi_addr,addr,(*dmi)->dmi_addrlen)==0 && alen==(*dmi)->dmi_addrlen)
+		if(st->hash_count[i])
 		{
-			struct dev_mc_list *tmp= *dmi;
-			if(--(*dmi)->dmi_users && !all)
-				return;
-			*dmi=(*dmi)->next;
-			dev->mc_count--;
-			kfree_s(tmp,sizeof(*tmp));
-			dev_mc_upload(dev);
-			return;
+			int h=i>>shift;
+			filter[h>>3]|=1<<(h&7);
 		}
 	}
+	return 0;
+}
+
+/*
+ *	Delete a device level multicast
+ */
+ 
+void dev_mc_delete(struct device *dev, void *addr, int alen, int all)
+{
+	struct dev_mc_list *dmi=dev_mc_find(dev,addr,alen);
+	struct dev_mc_state *st;
+	if(dmi==NULL)
+		return;
+	if(--dmi->dmi_users && !all)
+		return;
+	dev_mc_unlink(dmi);
+	st=dev_mc_state_find(dev);	/* Always there, it owns dmi */
+	dev_mc_pack_del(st,DEV_MC_NODE(dmi));
+	dev_mc_hash_del(st,dmi);
+	dev->mc_count--;
+	mc_arena_free(&st->nodes,DEV_MC_NODE(dmi));
+	dev_mc_changed(dev);
 }
 
 /*
@@ -161,26 +831,40 @@ void dev_mc_delete(struct device *dev, void *addr, int alen, int all)
  * */
 void dev_mc_add(struct device *dev, void *addr, int alen, int newonly)
 {
-	struct dev_mc_list *dmi;
-	for(dmi=dev->mc_list;dmi!=NULL;dmi=dmi->next)
+	struct dev_mc_list *dmi=dev_mc_find(dev,addr,alen);
+	struct dev_mc_list *new;
+	struct dev_mc_state *st;
+	if(dmi!=NULL)
 	{
-		if(memcmp(dmi->dmi_addr,addr,dmi->dmi_addrlen)==0 && dmi->dmi_addrlen==alen)
-		{
-			if(!newonly)
-				dmi->dmi_users++;
-			return;
-		}
+		if(!newonly)
+			dmi->dmi_users++;
+		return;
 	}
-	dmi=(struct dev_mc_list *)kmalloc(sizeof(*dmi),GFP_KERNEL);
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return;
+	if(dev_mc_hash_count>=dev_mc_hash_size && dev_mc_hash_size<DEV_MC_HASH_MAX)
+		dev_mc_hash_grow();
+	dmi=(struct dev_mc_list *)mc_arena_alloc(&st->nodes,GFP_KERNEL);
 	if(dmi==NULL)
 		return;	/* GFP_KERNEL so can't happen anyway */
+	/* All of the above can sleep, and another add get in first */
+	new=dev_mc_find(dev,addr,alen);
+	if(new!=NULL)
+	{
+		mc_arena_free(&st->nodes,dmi);
+		if(!newonly)
+			new->dmi_users++;
+		return;
+	}
 	memcpy(dmi->dmi_addr, addr, alen);
 	dmi->dmi_addrlen=alen;
-	dmi->next=dev->mc_list;
 	dmi->dmi_users=1;
-	dev->mc_list=dmi;
+	dev_mc_link(dev,dmi);
+	dev_mc_pack_add(st,DEV_MC_NODE(dmi));
+	dev_mc_hash_add(st,dmi);
 	dev->mc_count++;
-	dev_mc_upload(dev);
+	dev_mc_changed(dev);
 	/*
 	 * 118-126行代码对device结构中mc_list字段指向的多播地址列表进行查询，检查是否有相同
 	 * 的多播地址已经加入到列表中，如果存在，则根据newonly参数的设置，决定是仅仅增加已
@@ -196,16 +880,66 @@ void dev_mc_add(struct device *dev, void *addr, int alen, int newonly)
  *	该函数完成的功能是对device结构
  *	中mc_list字段指向的列表中所有地址进行释放，这个函数在关闭一个设备时被调用，具体
  *	的是在dev_close函数（dev.c）中被调用。
+ *
+ *	The device's upload state, its packed array and any held back
+ *	upload go with the entries.
  */
 
 void dev_mc_discard(struct device *dev)
 {
+	struct dev_mc_state *st, **stp;
+	unsigned long flags;
+	
 	while(dev->mc_list!=NULL)
-	{
-		struct dev_mc_list *tmp=dev->mc_list;
-		dev->mc_list=dev->mc_list->next;
-		kfree_s(tmp,sizeof(*tmp));
-	}
+		dev_mc_unlink(dev->mc_list);
 	dev->mc_count=0;
+	for(stp=&dev_mc_states;*stp!=NULL;stp=&(*stp)->next)
+		if((*stp)->dev==dev)
+			break;
+	if((st=*stp)==NULL)
+		return;
+	save_flags(flags);
+	cli();
+	*stp=st->next;
+	if(st->timer_running)
+		del_timer(&st->timer);
+	restore_flags(flags);
+	/* The entries all came from here, free them in one go */
+	dev_mc_pack_free(st);
+	mc_arena_release(&st->nodes);
+	kfree_s(st,sizeof(*st));
 }
 
+/*
+ *	Upload counters for /proc.
+ */
+ 
+int dev_mc_get_info(char *buffer, char **start, off_t offset, int length, int dummy)
+{
+	struct dev_mc_state *st;
+	int len=0;
+	off_t pos=0;
+	off_t begin=0;
+	
+	len+=sprintf(buffer,"Device   Count  Uploads  Coalesced Delay Batch Pending Limit AllMulti Chunks\n");
+	for(st=dev_mc_states;st!=NULL;st=st->next)
+	{
+		len+=sprintf(buffer+len,"%-8s %5d %8lu %10lu %5d %5d %7d %5d %8d %6d\n",
+			st->dev->name, st->dev->mc_count, st->uploads,
+			st->coalesced, st->delay, st->batch, st->pending,
+			st->limit, st->allmulti, st->nodes.nchunks);
+		pos=begin+len;
+		if(pos<offset)
+		{
+			len=0;
+			begin=pos;
+		}
+		if(pos>offset+length)
+			break;
+	}
+	*start=buffer+(offset-begin);
+	len-=(offset-begin);
+	if(len>length)
+		len=length;
+	return len;
+}
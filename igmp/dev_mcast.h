@@ -0,0 +1,60 @@
+/*
+ *	Linux NET3:	Multicast List maintenance.
+ *
+ *	Calls into dev_mcast.c beyond the basic list operations declared
+ *	with struct device.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _DEV_MCAST_H
+#define _DEV_MCAST_H
+
+/*
+ *	Passed to set_multicast_list as the address count when the device
+ *	should take every multicast frame. Drivers that only know about -1
+ *	treat any negative count as promiscuous, so it is only sent for
+ *	IFF_ALLMULTI to drivers that have said they understand it with
+ *	dev_mc_set_allmulti(). Other drivers get the list, as before.
+ *
+ *	It is also sent, to every driver, once a device has more addresses
+ *	than its cap. There is no cap by default; a driver sets one with
+ *	dev_mc_set_limit() when it opens, usually the size of its exact
+ *	filter, and the cap goes when the device is closed.
+ */
+ 
+#define DEV_MC_ALLMULTI		(-2)
+
+/*
+ *	Small fixed size objects carved out of larger blocks, so a device's
+ *	list entries sit together in memory. Everything in an arena can be
+ *	freed at once when the device goes away.
+ */
+ 
+struct mc_arena
+{
+	void *chunks;			/* Blocks, chained through their first word */
+	void *free;			/* Free objects, likewise */
+	int size;			/* Object size, rounded to a cache line */
+	int inuse;			/* Objects handed out */
+	int nchunks;
+};
+
+extern void mc_arena_init(struct mc_arena *a, int size);
+extern void *mc_arena_alloc(struct mc_arena *a, int priority);
+extern void mc_arena_free(struct mc_arena *a, void *obj);
+extern void mc_arena_release(struct mc_arena *a);
+
+extern int dev_mc_batch_begin(struct device *dev);
+extern int dev_mc_batch_hold(struct device *dev);
+extern void dev_mc_batch_end(struct device *dev);
+extern int dev_mc_set_delay(struct device *dev, int delay);
+extern int dev_mc_set_limit(struct device *dev, int limit);
+extern int dev_mc_set_allmulti(struct device *dev, int ok);
+extern int dev_mc_hash_filter(struct device *dev, int bits, unsigned char *filter);
+extern int dev_mc_get_info(char *buffer, char **start, off_t offset, int length, int dummy);
+
+#endif	/* _DEV_MCAST_H */
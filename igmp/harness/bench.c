@@ -0,0 +1,988 @@
+/*
+ * Benchmarks for igmp.c and dev_mcast.c on the harness, run against the
+ * old code as well wherever it has the same entry points.
+ *
+ *	bench [-o groups] name...
+ *
+ * -o caps the group count the old code is run at, 0 leaves it out; its
+ * setup is quadratic. Times are wall clock nanoseconds per operation,
+ * p50 and p99 over samples of a few operations each, and allocations
+ * count kmalloc and alloc_skb calls. Cache misses are read from the
+ * hardware counters where the kernel lets us have them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "harness.h"
+#include "old.h"
+
+struct impl
+{
+	const char *name;
+	int per_sock;			/* Memberships a socket can hold */
+	int (*rcv)(struct sk_buff *skb, struct device *dev, struct options *opt,
+		unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+		struct inet_protocol *protocol);
+	void (*allhost)(struct device *dev);
+	void (*drop_device)(struct device *dev);
+	int (*join)(struct sock *sk, struct device *dev, unsigned long addr);
+	int (*leave)(struct sock *sk, struct device *dev, unsigned long addr);
+	void (*drop_socket)(struct sock *sk);
+	void (*mc_add)(struct device *dev, void *addr, int alen, int newonly);
+	void (*mc_delete)(struct device *dev, void *addr, int alen, int all);
+	void (*mc_upload)(struct device *dev);
+	void (*mc_discard)(struct device *dev);
+};
+
+static struct impl impl_new = {
+	"new", 65536, igmp_rcv, ip_mc_allhost, ip_mc_drop_device,
+	ip_mc_join_group, ip_mc_leave_group, ip_mc_drop_socket,
+	dev_mc_add, dev_mc_delete, dev_mc_upload, dev_mc_discard
+};
+
+static struct impl impl_old = {
+	"old", IP_MAX_MEMBERSHIPS, old_igmp_rcv, old_ip_mc_allhost, old_ip_mc_drop_device,
+	old_ip_mc_join_group, old_ip_mc_leave_group, old_ip_mc_drop_socket,
+	old_dev_mc_add, old_dev_mc_delete, old_dev_mc_upload, old_dev_mc_discard
+};
+
+static struct impl impl_prearena = {
+	"pre", 65536, prearena_igmp_rcv, prearena_ip_mc_allhost, prearena_ip_mc_drop_device,
+	prearena_ip_mc_join_group, prearena_ip_mc_leave_group, prearena_ip_mc_drop_socket,
+	prearena_dev_mc_add, prearena_dev_mc_delete, prearena_dev_mc_upload, prearena_dev_mc_discard
+};
+
+static struct impl impl_precsum = {
+	"pre", 65536, precsum_igmp_rcv, precsum_ip_mc_allhost, precsum_ip_mc_drop_device,
+	precsum_ip_mc_join_group, precsum_ip_mc_leave_group, precsum_ip_mc_drop_socket,
+	precsum_dev_mc_add, precsum_dev_mc_delete, precsum_dev_mc_upload, precsum_dev_mc_discard
+};
+
+static int old_max = 10000;
+
+static struct impl *impls(int i, int groups)
+{
+	if (i == 0)
+		return &impl_new;
+	if (i == 1 && groups <= old_max)
+		return &impl_old;
+	return NULL;
+}
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+/*
+ * Measurement
+ */
+
+#define MAX_SAMPLES	(1 << 18)
+
+struct meter
+{
+	double *samples;		/* ns/op of each timed block */
+	int n;
+	long ops;
+	uint64_t ns;
+	unsigned long allocs;
+	uint64_t t0;
+	unsigned long a0;
+};
+
+static unsigned long allocs(void)
+{
+	return hs.kmallocs + hs.skb_allocs;
+}
+
+static void meter_init(struct meter *m)
+{
+	memset(m, 0, sizeof(*m));
+	m->samples = malloc(MAX_SAMPLES * sizeof(*m->samples));
+}
+
+static inline void meter_start(struct meter *m)
+{
+	m->a0 = allocs();
+	m->t0 = harness_ns();
+}
+
+static inline void meter_stop(struct meter *m, int ops)
+{
+	uint64_t d = harness_ns() - m->t0;
+
+	m->allocs += allocs() - m->a0;
+	m->ns += d;
+	m->ops += ops;
+	if (m->n < MAX_SAMPLES)
+		m->samples[m->n++] = (double)d / ops;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void header(const char *title)
+{
+	printf("\n%s\n%-14s %-3s %7s %6s %10s %10s %10s %9s\n", title,
+		"op", "", "groups", "socks", "ns/op", "p50", "p99", "allocs/op");
+}
+
+/* Print a line for the meter and free it */
+static void report(struct meter *m, const char *op, struct impl *im, int groups, int socks)
+{
+	if (m->ops)
+	{
+		qsort(m->samples, m->n, sizeof(m->samples[0]), cmp_double);
+		printf("%-14s %-3s %7d %6d %10.1f %10.1f %10.1f %9.2f\n", op, im->name, groups, socks,
+			(double)m->ns / m->ops, m->samples[m->n / 2], m->samples[m->n * 99 / 100],
+			(double)m->allocs / m->ops);
+		fflush(stdout);
+	}
+	free(m->samples);
+}
+
+/* Cache miss counter, -1 when there is none */
+static int miss_fd = -2;
+
+static long long misses(void)
+{
+	struct perf_event_attr pa;
+	long long v;
+
+	if (miss_fd == -2)
+	{
+		memset(&pa, 0, sizeof(pa));
+		pa.size = sizeof(pa);
+		pa.type = PERF_TYPE_HARDWARE;
+		pa.config = PERF_COUNT_HW_CACHE_MISSES;
+		pa.exclude_kernel = 1;
+		pa.exclude_hv = 1;
+		miss_fd = syscall(SYS_perf_event_open, &pa, 0, -1, -1, 0);
+	}
+	if (miss_fd < 0 || read(miss_fd, &v, sizeof(v)) != sizeof(v))
+		return -1;
+	return v;
+}
+
+/*
+ * A host with groups joined, spread over as few sockets as will hold
+ * them. Given more sockets than groups, each socket joins one.
+ */
+
+struct host
+{
+	struct impl *im;
+	struct device *dev;
+	struct sock **sk;
+	int nsk;
+	int groups;
+};
+
+static struct host *host_up(struct impl *im, int groups, int nsk)
+{
+	struct host *h = calloc(1, sizeof(*h));
+	int i;
+
+	if (nsk < (groups + im->per_sock - 1) / im->per_sock)
+		nsk = (groups + im->per_sock - 1) / im->per_sock;
+	if (nsk == 0)
+		nsk = 1;
+	h->im = im;
+	h->dev = harness_dev("eth0", htonl(0x0A000002), 1);
+	h->sk = calloc(nsk, sizeof(*h->sk));
+	h->nsk = nsk;
+	h->groups = groups;
+	for (i = 0; i < nsk; i++)
+		h->sk[i] = harness_sock();
+	im->allhost(h->dev);
+	for (i = 0; groups && (i < groups || i < nsk); i++)
+		if (im->join(h->sk[i % nsk], h->dev, harness_group(i % groups)) != 0)
+		{
+			fprintf(stderr, "%s: join %d failed\n", im->name, i);
+			exit(1);
+		}
+	return h;
+}
+
+static void host_down(struct host *h)
+{
+	int i;
+
+	while (harness_timers_pending())
+		harness_tick(1);
+	for (i = 0; i < h->nsk; i++)
+	{
+		h->im->drop_socket(h->sk[i]);
+		harness_sock_free(h->sk[i]);
+	}
+	h->im->drop_device(h->dev);
+	h->im->mc_discard(h->dev);
+	free(h->sk);
+	free(h);
+}
+
+/* Deliver n prepared datagrams as the bottom half would */
+static void deliver(struct impl *im, struct device *dev, struct sk_buff **skb, int n)
+{
+	int i;
+
+	harness_bh_enter();
+	for (i = 0; i < n; i++)
+		im->rcv(skb[i], dev, NULL, skb[i]->daddr, skb[i]->len - sizeof(struct iphdr),
+			skb[i]->saddr, 0, NULL);
+	harness_bh_exit();
+}
+
+#define BATCH	64
+
+/*
+ * Group lookup: a report from another member for one of our groups, the
+ * commonest lookup and the one made in the bottom half. The new code is
+ * also timed on ip_mc_source_ok, which is the index lookup alone.
+ */
+static void bench_lookup(void)
+{
+	static const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+	struct sk_buff *skb[BATCH];
+	struct igmphdr igh;
+	struct meter m;
+	struct host *h;
+	struct impl *im;
+	unsigned long g;
+	unsigned int s, i, k, r;
+
+	header("Group lookup: report heard for a joined group");
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if ((im = impls(i, sizes[s])) == NULL)
+				continue;
+			h = host_up(im, sizes[s], 0);
+			meter_init(&m);
+			for (r = 0; r < 256; r++)
+			{
+				for (k = 0; k < BATCH; k++)
+				{
+					g = harness_group(rnd() % sizes[s]);
+					harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_REPORT, 0, g);
+					skb[k] = harness_igmp_skb(h->dev, g, htonl(0x0A000063), &igh, sizeof(igh), 1);
+				}
+				meter_start(&m);
+				deliver(im, h->dev, skb, BATCH);
+				meter_stop(&m, BATCH);
+			}
+			report(&m, "report-rcv", im, sizes[s], h->nsk);
+			if (im == &impl_new)
+			{
+				unsigned long grp[BATCH];
+				volatile int found = 0;
+
+				meter_init(&m);
+				for (r = 0; r < 1024; r++)
+				{
+					for (k = 0; k < BATCH; k++)
+						grp[k] = harness_group(rnd() % sizes[s]);
+					meter_start(&m);
+					for (k = 0; k < BATCH; k++)
+						found += ip_mc_source_ok(h->dev, grp[k], 1);
+					meter_stop(&m, BATCH);
+				}
+				report(&m, "lookup", im, sizes[s], h->nsk);
+			}
+			host_down(h);
+		}
+	}
+}
+
+/*
+ * Device address list: add N addresses, then delete them all, as the
+ * IP layer does for N joins and leaves. The new code is run again with
+ * the whole lot in one upload batch.
+ */
+static void mc_addr(unsigned char *mac, int i)
+{
+	mac[0] = 0x01;
+	mac[1] = 0x00;
+	mac[2] = 0x5e;
+	mac[3] = (i >> 16) & 0x7F;
+	mac[4] = i >> 8;
+	mac[5] = i;
+}
+
+#define BLOCK	16
+
+static void bench_devmc_run(struct impl *im, int n, int batch)
+{
+	struct device *dev = harness_dev("eth0", htonl(0x0A000002), 1);
+	unsigned char mac[ETH_ALEN];
+	struct meter add, del;
+	int i, k;
+
+	meter_init(&add);
+	meter_init(&del);
+	if (batch)
+		dev_mc_batch_begin(dev);
+	for (i = 0; i < n; i += BLOCK)
+	{
+		meter_start(&add);
+		for (k = i; k < i + BLOCK && k < n; k++)
+		{
+			mc_addr(mac, k);
+			im->mc_add(dev, mac, ETH_ALEN, 0);
+		}
+		meter_stop(&add, k - i);
+	}
+	if (batch)
+		dev_mc_batch_end(dev);
+	if (dev->mc_count != n)
+	{
+		fprintf(stderr, "%s: %d addresses, expected %d\n", im->name, dev->mc_count, n);
+		exit(1);
+	}
+	if (batch)
+		dev_mc_batch_begin(dev);
+	for (i = 0; i < n; i += BLOCK)
+	{
+		meter_start(&del);
+		for (k = i; k < i + BLOCK && k < n; k++)
+		{
+			mc_addr(mac, k);
+			im->mc_delete(dev, mac, ETH_ALEN, 0);
+		}
+		meter_stop(&del, k - i);
+	}
+	if (batch)
+		dev_mc_batch_end(dev);
+	report(&add, batch ? "add-batched" : "add", im, n, 0);
+	report(&del, batch ? "delete-batched" : "delete", im, n, 0);
+	im->mc_discard(dev);
+}
+
+static void bench_devmc(void)
+{
+	static const int sizes[] = { 1000, 10000, 100000 };
+	struct impl *im;
+	unsigned int s, i;
+
+	header("Device address list: bulk add then delete");
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		for (i = 0; i < 2; i++)
+			if ((im = impls(i, sizes[s])) != NULL)
+				bench_devmc_run(im, sizes[s], 0);
+		bench_devmc_run(&impl_new, sizes[s], 1);
+	}
+}
+
+/*
+ * One socket joining N groups, then leaving them, then joining again
+ * and closing. The old code stops at IP_MAX_MEMBERSHIPS. The "shared"
+ * rows have another socket in every group already, so the device side
+ * only counts a user and what is left is the socket's own set.
+ */
+static void bench_sockjoin_run(struct impl *im, int n, int shared)
+{
+	struct host *h = host_up(im, shared ? n : 0, 0);
+	struct sock *sk = harness_sock();
+	struct meter join, leave, drop;
+	int i, k, rep;
+
+	meter_init(&join);
+	meter_init(&leave);
+	meter_init(&drop);
+	/* Small sets are run a few times over to get enough samples */
+	for (rep = 0; rep * n < 4096; rep++)
+	{
+		for (i = 0; i < n; i += BLOCK)
+		{
+			meter_start(&join);
+			for (k = i; k < i + BLOCK && k < n; k++)
+				if (im->join(sk, h->dev, harness_group(k)) != 0)
+					break;
+			meter_stop(&join, k - i);
+			if (k < i + BLOCK && k < n)
+			{
+				fprintf(stderr, "%s: join %d failed\n", im->name, k);
+				exit(1);
+			}
+		}
+		for (i = 0; i < n; i += BLOCK)
+		{
+			meter_start(&leave);
+			for (k = i; k < i + BLOCK && k < n; k++)
+				im->leave(sk, h->dev, harness_group(k));
+			meter_stop(&leave, k - i);
+		}
+		for (i = 0; i < n; i++)
+			im->join(sk, h->dev, harness_group(i));
+		meter_start(&drop);
+		im->drop_socket(sk);
+		meter_stop(&drop, n);
+	}
+	report(&join, shared ? "join-shared" : "join", im, n, 1);
+	report(&leave, shared ? "leave-shared" : "leave", im, n, 1);
+	report(&drop, shared ? "drop-shared" : "drop", im, n, 1);
+	harness_sock_free(sk);
+	host_down(h);
+}
+
+static void bench_sockjoin(void)
+{
+	static const int sizes[] = { 10, 20, 100, 1000, 10000, 65536 };
+	struct impl *im;
+	unsigned int s, i;
+
+	header("Memberships of one socket: per join, leave and membership dropped");
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if ((im = impls(i, sizes[s])) == NULL || sizes[s] > im->per_sock)
+				continue;
+			bench_sockjoin_run(im, sizes[s], 0);
+			bench_sockjoin_run(im, sizes[s], 1);
+		}
+	}
+}
+
+/*
+ * A general v1 query and the ten seconds after it: the cost of taking
+ * the query, which starts a delay for every group, and of the timer
+ * ticks that send the reports, per report sent.
+ */
+static void bench_query(void)
+{
+	static const int sizes[] = { 1000, 10000, 100000 };
+	struct meter query, expiry;
+	struct sk_buff *skb;
+	struct igmphdr igh;
+	struct host *h;
+	struct impl *im;
+	unsigned long x;
+	unsigned int s, i, r, t;
+
+	header("General query: taking it, and sending the reports after it");
+	harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_QUERY, 0, 0);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		for (i = 0; i < 2; i++)
+		{
+			if ((im = impls(i, sizes[s])) == NULL)
+				continue;
+			h = host_up(im, sizes[s], 0);
+			meter_init(&query);
+			meter_init(&expiry);
+			for (r = 0; r < 8; r++)
+			{
+				skb = harness_igmp_skb(h->dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &igh, sizeof(igh), 1);
+				meter_start(&query);
+				deliver(im, h->dev, &skb, 1);
+				meter_stop(&query, sizes[s]);
+				for (t = 0; t < 10 * HZ; t++)
+				{
+					x = hs.xmits;
+					meter_start(&expiry);
+					harness_tick(1);
+					if (hs.xmits != x)
+						meter_stop(&expiry, hs.xmits - x);
+				}
+			}
+			report(&query, "query/group", im, sizes[s], h->nsk);
+			report(&expiry, "expiry/report", im, sizes[s], h->nsk);
+			host_down(h);
+		}
+	}
+}
+
+/*
+ * Node allocation, before and after the arenas. Joins and leaves of
+ * random groups churn the device's nodes, timed per join and per leave
+ * with the allocations they make. The lists are walked fresh and after
+ * the churn, per node, with cache misses where they can be counted;
+ * the drop is every socket, then the device, per group.
+ */
+
+#define WALK_NODES	(1 << 22)
+
+static void walk_report(const char *op, struct impl *im, int groups, uint64_t ns,
+	long long miss, long nodes)
+{
+	char m[16];
+
+	if (miss < 0)
+		strcpy(m, "-");
+	else
+		snprintf(m, sizeof(m), "%.3f", (double)miss / nodes);
+	printf("%-14s %-3s %7d %6s %10.2f %10s %10s %9s\n", op, im->name, groups, "",
+		(double)ns / nodes, "", "", m);
+	fflush(stdout);
+}
+
+static void walk(struct host *h, const char *when)
+{
+	struct ip_mc_list *im;
+	struct dev_mc_list *dmi;
+	volatile unsigned long sink;
+	unsigned long x;
+	long long m0, m1;
+	uint64_t t0, t1;
+	long nodes;
+	char op[16];
+
+	m0 = misses();
+	t0 = harness_ns();
+	for (nodes = 0, x = 0; nodes < WALK_NODES; )
+		for (im = h->dev->ip_mc_list; im != NULL; im = im->next, nodes++)
+			x += im->multiaddr;
+	t1 = harness_ns();
+	m1 = misses();
+	sink = x;
+	snprintf(op, sizeof(op), "ip-walk-%s", when);
+	walk_report(op, h->im, h->groups, t1 - t0, m0 < 0 ? -1 : m1 - m0, nodes);
+
+	m0 = misses();
+	t0 = harness_ns();
+	for (nodes = 0, x = 0; nodes < WALK_NODES; )
+		for (dmi = h->dev->mc_list; dmi != NULL; dmi = dmi->next, nodes++)
+			x += dmi->dmi_addr[5];
+	t1 = harness_ns();
+	m1 = misses();
+	sink = x;
+	(void)sink;
+	snprintf(op, sizeof(op), "dev-walk-%s", when);
+	walk_report(op, h->im, h->groups, t1 - t0, m0 < 0 ? -1 : m1 - m0, nodes);
+}
+
+static void bench_alloc_run(struct impl *im, int n)
+{
+	struct host *h = host_up(im, n, 0);
+	struct meter join, leave, drop;
+	int g[BLOCK];
+	int i, k;
+
+	walk(h, "fresh");
+	meter_init(&join);
+	meter_init(&leave);
+	meter_init(&drop);
+	for (i = 0; i < 4 * n && i < 200000; i += BLOCK)
+	{
+		/* Distinct, so each leave drops the group */
+		for (k = 0; k < BLOCK; k++)
+			g[k] = (rnd() % (n / BLOCK)) * BLOCK + k;
+		meter_start(&leave);
+		for (k = 0; k < BLOCK; k++)
+			im->leave(h->sk[g[k] % h->nsk], h->dev, harness_group(g[k]));
+		meter_stop(&leave, BLOCK);
+		meter_start(&join);
+		for (k = 0; k < BLOCK; k++)
+			im->join(h->sk[g[k] % h->nsk], h->dev, harness_group(g[k]));
+		meter_stop(&join, BLOCK);
+	}
+	report(&join, "join", im, n, h->nsk);
+	report(&leave, "leave", im, n, h->nsk);
+	walk(h, "churn");
+
+	while (harness_timers_pending())
+		harness_tick(1);
+	meter_start(&drop);
+	for (i = 0; i < h->nsk; i++)
+		im->drop_socket(h->sk[i]);
+	im->drop_device(h->dev);
+	im->mc_discard(h->dev);
+	meter_stop(&drop, n);
+	report(&drop, "drop/group", im, n, h->nsk);
+	host_down(h);
+}
+
+static void bench_alloc(void)
+{
+	static const int sizes[] = { 1000, 10000, 100000 };
+	unsigned int s;
+
+	header("Node allocation: churn, list walks (ns/node, misses/node) and drop");
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		bench_alloc_run(&impl_prearena, sizes[s]);
+		bench_alloc_run(&impl_new, sizes[s]);
+	}
+}
+
+/*
+ * Taking an 8 byte message, before and after igmp_rcv summed them
+ * inline, with few groups so that the lookup does not hide the check:
+ * reports for groups we are in and groups we are not, and messages
+ * with a bad checksum, which are thrown away on the check alone. The
+ * old code called the harness's C ip_compute_csum, not the kernel's
+ * assembler one.
+ */
+static void bench_rcv(void)
+{
+	static const char *kinds[] = { "report-ours", "report-other", "bad-csum" };
+	struct impl *ims[] = { &impl_precsum, &impl_new };
+	struct sk_buff *skb[BATCH];
+	struct igmphdr igh;
+	struct meter m;
+	struct host *h;
+	unsigned long g;
+	unsigned int i, kind, k, r;
+
+	header("Taking 8 byte messages, before and after the inline check");
+	for (i = 0; i < 2; i++)
+	{
+		h = host_up(ims[i], 10, 0);
+		for (kind = 0; kind < 3; kind++)
+		{
+			meter_init(&m);
+			for (r = 0; r < 2048; r++)
+			{
+				for (k = 0; k < BATCH; k++)
+				{
+					g = harness_group(rnd() % 10 + (kind == 1 ? 10 : 0));
+					harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_REPORT, 0, g);
+					if (kind == 2)
+						igh.csum ^= 1 << (rnd() % 16);
+					skb[k] = harness_igmp_skb(h->dev, g, htonl(0x0A000063), &igh, sizeof(igh), 1);
+				}
+				meter_start(&m);
+				deliver(ims[i], h->dev, skb, BATCH);
+				meter_stop(&m, BATCH);
+			}
+			report(&m, kinds[kind], ims[i], 10, h->nsk);
+		}
+		host_down(h);
+	}
+}
+
+/*
+ * Readers against a writer. Reader threads look groups up in the
+ * bottom half, as delivery does, and now and then walk the device's
+ * address list, as a driver does. One writer keeps joining and leaving
+ * a set of groups on the same device. The permanent groups are never
+ * left and must always be found. Scaling is read throughput against the
+ * number of readers, and only means something on as many CPUs.
+ */
+
+#define STRESS_PERM	256
+#define STRESS_CHURN	4096
+
+static struct
+{
+	struct device *dev;
+	volatile int stop;
+	unsigned long misses;		/* Permanent groups not found */
+} st;
+
+static void *stress_reader(void *arg)
+{
+	unsigned long *reads = arg, n = 0, bad = 0, grp;
+	unsigned int r = *reads, k;
+	struct dev_mc_list *dmi;
+	int found, g;
+
+	harness_thread_init();
+	while (!st.stop)
+	{
+		harness_bh_enter();
+		for (k = 0; k < BATCH; k++)
+		{
+			r = r * 1103515245 + 12345;
+			grp = harness_group((r >> 8) % STRESS_PERM);
+			if (!ip_mc_source_ok(st.dev, grp, htonl(0x0A000063)))
+				bad++;
+			grp = harness_group(STRESS_PERM + (r >> 8) % STRESS_CHURN);
+			ip_mc_source_ok(st.dev, grp, htonl(0x0A000063));
+		}
+		n += 2 * BATCH;
+		if ((n & 1023) == 0)
+		{
+			/* All the permanent addresses are on the list */
+			found = 0;
+			for (dmi = st.dev->mc_list; dmi != NULL; dmi = dmi->next)
+			{
+				g = (dmi->dmi_addr[4] & 0xFF) << 8 | (dmi->dmi_addr[5] & 0xFF);
+				if (dmi->dmi_addr[3] == 0x01 && g < STRESS_PERM)
+					found++;
+			}
+			if (found != STRESS_PERM)
+				bad++;
+		}
+		harness_bh_exit();
+	}
+	__atomic_fetch_add(&st.misses, bad, __ATOMIC_RELAXED);
+	*reads = n;
+	return NULL;
+}
+
+static void bench_stress(void)
+{
+	static const int readers[] = { 1, 2, 4, 8 };
+	struct sock *perm = harness_sock(), *sk = harness_sock();
+	pthread_t tid[8];
+	unsigned long reads[8], total, writes;
+	uint64_t t0, t;
+	unsigned int s, i;
+
+	printf("\nReaders in the bottom half against one writer, %ld CPUs\n"
+		"%7s %12s %12s %12s\n", sysconf(_SC_NPROCESSORS_ONLN),
+		"readers", "reads/s", "per reader", "writes/s");
+	st.dev = harness_dev("eth0", htonl(0x0A000002), 1);
+	ip_mc_allhost(st.dev);
+	for (i = 0; i < STRESS_PERM; i++)
+		ip_mc_join_group(perm, st.dev, harness_group(i));
+	for (s = 0; s < sizeof(readers) / sizeof(readers[0]); s++)
+	{
+		st.stop = 0;
+		for (i = 0; i < readers[s]; i++)
+		{
+			reads[i] = i + 1;		/* Seeds the reader */
+			pthread_create(&tid[i], NULL, stress_reader, &reads[i]);
+		}
+		writes = 0;
+		t0 = harness_ns();
+		while ((t = harness_ns() - t0) < 1000000000)
+		{
+			for (i = 0; i < STRESS_CHURN; i++)
+				ip_mc_join_group(sk, st.dev, harness_group(STRESS_PERM + i));
+			for (i = 0; i < STRESS_CHURN; i++)
+				ip_mc_leave_group(sk, st.dev, harness_group(STRESS_PERM + i));
+			writes += 2 * STRESS_CHURN;
+			while (harness_timers_pending())
+				harness_tick(1);
+		}
+		st.stop = 1;
+		for (total = 0, i = 0; i < readers[s]; i++)
+		{
+			pthread_join(tid[i], NULL);
+			total += reads[i];
+		}
+		printf("%7d %12.0f %12.0f %12.0f\n", readers[s], total * 1e9 / t,
+			total * 1e9 / t / readers[s], writes * 1e9 / t);
+		fflush(stdout);
+	}
+	ip_mc_drop_socket(sk);
+	ip_mc_drop_socket(perm);
+	harness_sock_free(sk);
+	harness_sock_free(perm);
+	ip_mc_drop_device(st.dev);
+	dev_mc_discard(st.dev);
+	if (st.misses)
+	{
+		fprintf(stderr, "stress: %lu lookups missed a permanent group\n", st.misses);
+		exit(1);
+	}
+}
+
+/*
+ * The whole control plane at one size: joins and leaves of random
+ * memberships, a report and a general query heard, device addresses
+ * added and deleted beside the groups' own, a full upload, and every
+ * socket closed, per socket.
+ */
+static void bench_suite_run(struct impl *im, int groups, int socks)
+{
+	struct host *h = host_up(im, groups, socks);
+	struct meter join, leave, report_m, query, add, del, upload, drop;
+	struct sk_buff *skb[BATCH];
+	struct igmphdr igh;
+	unsigned char mac[ETH_ALEN];
+	unsigned long g;
+	int m[BLOCK];
+	int i, k, r, n;
+
+	meter_init(&join);
+	meter_init(&leave);
+	meter_init(&report_m);
+	meter_init(&query);
+	meter_init(&add);
+	meter_init(&del);
+	meter_init(&upload);
+	meter_init(&drop);
+
+	/* Memberships, by the index host_up joined them at */
+	n = groups > h->nsk ? groups : h->nsk;
+	for (r = 0; r < 256; r++)
+	{
+		for (k = 0; k < BLOCK; k++)
+			m[k] = n < BLOCK ? k % n : (rnd() % (n / BLOCK)) * BLOCK + k;
+		k = n < BLOCK ? n : BLOCK;
+		meter_start(&leave);
+		for (i = 0; i < k; i++)
+			im->leave(h->sk[m[i] % h->nsk], h->dev, harness_group(m[i] % groups));
+		meter_stop(&leave, k);
+		meter_start(&join);
+		for (i = 0; i < k; i++)
+			im->join(h->sk[m[i] % h->nsk], h->dev, harness_group(m[i] % groups));
+		meter_stop(&join, k);
+	}
+	while (harness_timers_pending())
+		harness_tick(1);
+
+	for (r = 0; r < 256; r++)
+	{
+		for (k = 0; k < BATCH; k++)
+		{
+			g = harness_group(rnd() % groups);
+			harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_REPORT, 0, g);
+			skb[k] = harness_igmp_skb(h->dev, g, htonl(0x0A000063), &igh, sizeof(igh), 1);
+		}
+		meter_start(&report_m);
+		deliver(im, h->dev, skb, BATCH);
+		meter_stop(&report_m, BATCH);
+	}
+
+	harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_QUERY, 0, 0);
+	for (r = 0; r < 4; r++)
+	{
+		skb[0] = harness_igmp_skb(h->dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &igh, sizeof(igh), 1);
+		meter_start(&query);
+		deliver(im, h->dev, skb, 1);
+		meter_stop(&query, 1);
+		while (harness_timers_pending())
+			harness_tick(1);
+	}
+
+	/* Above the groups' own addresses */
+	for (r = 0; r < 64; r++)
+	{
+		meter_start(&add);
+		for (k = 0; k < BLOCK; k++)
+		{
+			mc_addr(mac, 0x400000 + r * BLOCK + k);
+			im->mc_add(h->dev, mac, ETH_ALEN, 0);
+		}
+		meter_stop(&add, BLOCK);
+	}
+	for (r = 0; r < 64; r++)
+	{
+		meter_start(&del);
+		for (k = 0; k < BLOCK; k++)
+		{
+			mc_addr(mac, 0x400000 + r * BLOCK + k);
+			im->mc_delete(h->dev, mac, ETH_ALEN, 0);
+		}
+		meter_stop(&del, BLOCK);
+	}
+	for (r = 0; r < 16; r++)
+	{
+		meter_start(&upload);
+		im->mc_upload(h->dev);
+		meter_stop(&upload, 1);
+	}
+
+	for (i = 0; i < h->nsk; i++)
+	{
+		meter_start(&drop);
+		im->drop_socket(h->sk[i]);
+		meter_stop(&drop, 1);
+	}
+
+	report(&join, "join", im, groups, h->nsk);
+	report(&leave, "leave", im, groups, h->nsk);
+	report(&report_m, "report-rcv", im, groups, h->nsk);
+	report(&query, "query-rcv", im, groups, h->nsk);
+	report(&add, "mc-add", im, groups, h->nsk);
+	report(&del, "mc-delete", im, groups, h->nsk);
+	report(&upload, "mc-upload", im, groups, h->nsk);
+	report(&drop, "drop-socket", im, groups, h->nsk);
+	host_down(h);
+}
+
+static void bench_suite(void)
+{
+	static const int groups[] = { 1, 10, 100, 1000, 10000, 100000 };
+	static const int socks[] = { 1, 100, 10000 };
+	struct impl *im;
+	unsigned int g, s, i;
+
+	header("Control plane suite: per op, except query-rcv per query and drop-socket per socket");
+	for (g = 0; g < sizeof(groups) / sizeof(groups[0]); g++)
+		for (s = 0; s < sizeof(socks) / sizeof(socks[0]); s++)
+			for (i = 0; i < 2; i++)
+			{
+				if ((im = impls(i, groups[g])) == NULL)
+					continue;
+				/* More groups than these sockets can hold */
+				if (groups[g] > socks[s] * im->per_sock)
+					continue;
+				bench_suite_run(im, groups[g], socks[s]);
+			}
+}
+
+static struct
+{
+	const char *name;
+	void (*fn)(void);
+	const char *what;
+} benches[] = {
+	{ "suite", bench_suite, "every entry point at 1 to 100k groups and 1 to 10k sockets" },
+	{ "lookup", bench_lookup, "group lookup from 10 to 100k groups" },
+	{ "devmc", bench_devmc, "bulk dev_mc_add/dev_mc_delete at 1k to 100k addresses" },
+	{ "sockjoin", bench_sockjoin, "join, leave and close on one socket with up to 64k groups" },
+	{ "query", bench_query, "general query and report timers at 1k to 100k groups" },
+	{ "rcv", bench_rcv, "8 byte message checks before and after they were inlined" },
+	{ "alloc", bench_alloc, "node allocation and list walks before and after the arenas" },
+	{ "stress", bench_stress, "lock-free readers against a joining and leaving writer" },
+};
+
+#define NBENCH	(sizeof(benches) / sizeof(benches[0]))
+
+static void usage(void)
+{
+	unsigned int i;
+
+	fprintf(stderr, "usage: bench [-o groups] all|name...\n");
+	for (i = 0; i < NBENCH; i++)
+		fprintf(stderr, "  %-10s %s\n", benches[i].name, benches[i].what);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int c, a;
+
+	while ((c = getopt(argc, argv, "o:")) != -1)
+	{
+		switch (c)
+		{
+			case 'o':
+				old_max = atoi(optarg);
+				break;
+			default:
+				usage();
+		}
+	}
+	if (optind == argc)
+		usage();
+	harness_quiet = 1;
+	for (a = optind; a < argc; a++)
+	{
+		for (i = 0; i < NBENCH; i++)
+			if (strcmp(argv[a], "all") == 0 || strcmp(argv[a], benches[i].name) == 0)
+				break;
+		if (i == NBENCH)
+			usage();
+		for (; i < NBENCH; i++)
+		{
+			if (strcmp(argv[a], "all") != 0 && strcmp(argv[a], benches[i].name) != 0)
+				continue;
+			benches[i].fn();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,989 @@
+/*
+ * Functional tests for igmp.c and dev_mcast.c on the harness. Each test
+ * brings up its own devices, so the kernel's global state carries over
+ * from one to the next as it would on a running box.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "harness.h"
+
+static int failures;
+
+#define CHECK(c) \
+	do { \
+		if (!(c)) { \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #c); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Frames sent, as harness_xmit saw them */
+struct frame
+{
+	unsigned long when;
+	struct device *dev;
+	unsigned char mac[ETH_ALEN];
+	unsigned long daddr;
+	int type;
+	unsigned long group;
+	int len;
+	int csum_ok;
+};
+
+#define MAX_FRAMES	4096
+
+static struct frame frames[MAX_FRAMES];
+static int nframes;
+
+static void capture(struct device *dev, struct sk_buff *skb)
+{
+	struct frame *f;
+	struct igmphdr *igh;
+	int len;
+
+	if (nframes == MAX_FRAMES)
+		return;
+	f = &frames[nframes++];
+	igh = harness_frame_igmp(dev, skb, &len);
+	f->when = jiffies;
+	f->dev = dev;
+	memcpy(f->mac, skb->data, ETH_ALEN);
+	f->daddr = skb->ip_hdr->daddr;
+	f->type = igh->type;
+	f->group = igh->group;
+	f->len = len;
+	f->csum_ok = ip_compute_csum((unsigned char *)igh, len) == 0 &&
+		ip_compute_csum((unsigned char *)skb->ip_hdr, 20) == 0;
+}
+
+static void reset_frames(void)
+{
+	nframes = 0;
+}
+
+static int count_frames(int type, unsigned long group)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nframes; i++)
+		if (frames[i].type == type && (group == 0 || frames[i].group == group))
+			n++;
+	return n;
+}
+
+/* The Queries/Reports/Suppressed/Duplicates line of /proc/net/igmp */
+static void igmp_counters(unsigned long *c)
+{
+	char buf[512], *start;
+
+	igmp_get_info(buf, &start, 0, sizeof(buf), 0);
+	if (sscanf(strchr(buf, '\n'), "%lu %lu %lu %lu", &c[0], &c[1], &c[2], &c[3]) != 4)
+		memset(c, 0, 4 * sizeof(*c));
+}
+
+static struct device *dev_up(const char *name, unsigned int host)
+{
+	struct device *dev = harness_dev(name, htonl(0x0A000000 + host), 1);
+
+	ip_mc_allhost(dev);
+	return dev;
+}
+
+/* As dev_close does, then the device is gone */
+static void dev_down(struct device *dev)
+{
+	ip_mc_drop_device(dev);
+	dev_mc_discard(dev);
+	harness_dev_free(dev);
+}
+
+static void drain(void)
+{
+	int n = 0;
+
+	while (harness_timers_pending() && n++ < 100 * HZ)
+		harness_tick(1);
+}
+
+static void test_join_leave(void)
+{
+	struct device *dev = dev_up("eth0", 1);
+	struct sock *sk = harness_sock();
+	unsigned long g = harness_group(1);
+	unsigned char mac[ETH_ALEN];
+
+	reset_frames();
+	CHECK(ip_mc_join_group(sk, dev, g) == 0);
+	CHECK(ip_mc_join_group(sk, dev, g) == -EADDRINUSE);
+	CHECK(ip_mc_join_group(sk, dev, htonl(0x0A000001)) == -EINVAL);
+	CHECK(nframes == 1);
+	CHECK(frames[0].type == IGMP_HOST_MEMBERSHIP_REPORT);
+	CHECK(frames[0].group == g && frames[0].daddr == g);
+	CHECK(frames[0].csum_ok);
+	harness_mc_map(g, mac);
+	CHECK(memcmp(frames[0].mac, mac, ETH_ALEN) == 0);
+	/* All hosts and the group */
+	CHECK(dev->mc_count == 2);
+	CHECK(HARNESS_DEV(dev)->mc_num == 2);
+	CHECK(ip_mc_source_ok(dev, g, htonl(0x0A000063)));
+
+	reset_frames();
+	CHECK(ip_mc_leave_group(sk, dev, g) == 0);
+	CHECK(ip_mc_leave_group(sk, dev, g) == -EADDRNOTAVAIL);
+	CHECK(nframes == 1);
+	CHECK(frames[0].type == IGMP_HOST_LEAVE_MESSAGE);
+	CHECK(frames[0].daddr == htonl(0xE0000002));
+	CHECK(dev->mc_count == 1);
+	CHECK(!ip_mc_source_ok(dev, g, htonl(0x0A000063)));
+
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	ip_mc_drop_device(dev);
+	dev_mc_discard(dev);
+	CHECK(dev->mc_count == 0 && dev->mc_list == NULL && dev->ip_mc_list == NULL);
+	harness_dev_free(dev);
+}
+
+/* Two sockets in a group: one report, and the group stays till both go */
+static void test_shared_group(void)
+{
+	struct device *dev = dev_up("eth1", 1);
+	struct sock *a = harness_sock(), *b = harness_sock();
+	unsigned long g = harness_group(2);
+
+	reset_frames();
+	CHECK(ip_mc_join_group(a, dev, g) == 0);
+	CHECK(ip_mc_join_group(b, dev, g) == 0);
+	CHECK(count_frames(IGMP_HOST_MEMBERSHIP_REPORT, g) == 1);
+	ip_mc_drop_socket(a);
+	CHECK(count_frames(IGMP_HOST_LEAVE_MESSAGE, 0) == 0);
+	CHECK(ip_mc_source_ok(dev, g, 1));
+	ip_mc_drop_socket(b);
+	CHECK(count_frames(IGMP_HOST_LEAVE_MESSAGE, 0) == 1);
+	CHECK(dev->mc_count == 1);
+	harness_sock_free(a);
+	harness_sock_free(b);
+	dev_down(dev);
+}
+
+/* A v1 general query gets one report per group within 10 seconds */
+static void test_query_v1(void)
+{
+	struct device *dev = dev_up("eth2", 1);
+	struct sock *sk = harness_sock();
+	unsigned long start;
+	int i;
+
+	for (i = 0; i < 50; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(100 + i)) == 0);
+	reset_frames();
+	start = jiffies;
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 0, 0);
+	CHECK(nframes == 0);
+	CHECK(harness_timers_pending());
+	harness_tick(10 * HZ);
+	CHECK(nframes == 50);
+	for (i = 0; i < 50; i++)
+		CHECK(count_frames(IGMP_HOST_MEMBERSHIP_REPORT, harness_group(100 + i)) == 1);
+	for (i = 0; i < nframes; i++)
+		CHECK(frames[i].when > start && frames[i].when <= start + 10 * HZ);
+	/* The all hosts group is never reported */
+	CHECK(count_frames(IGMP_HOST_MEMBERSHIP_REPORT, IGMP_ALL_HOSTS) == 0);
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* v2: the answer comes within Max Response Time and as a v2 report */
+static void test_query_v2(void)
+{
+	struct device *dev = dev_up("eth3", 1);
+	struct sock *sk = harness_sock();
+	unsigned long start;
+	int i;
+
+	for (i = 0; i < 20; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(200 + i)) == 0);
+	reset_frames();
+	start = jiffies;
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 10, 0);
+	harness_tick(HZ);
+	CHECK(count_frames(0x16, 0) == 20);
+	for (i = 0; i < nframes; i++)
+		CHECK(frames[i].when <= start + HZ);
+	/* A v2 host leaves with a leave message to all routers */
+	reset_frames();
+	CHECK(ip_mc_leave_group(sk, dev, harness_group(200)) == 0);
+	CHECK(count_frames(IGMP_HOST_LEAVE_MESSAGE, harness_group(200)) == 1);
+	/* A group specific query only asks about that group */
+	reset_frames();
+	harness_igmp(dev, harness_group(201), IGMP_HOST_MEMBERSHIP_QUERY, 10, harness_group(201));
+	harness_tick(HZ);
+	CHECK(nframes == 1 && frames[0].group == harness_group(201));
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* Reports after the first copy a resolved header: no ARP, no route */
+static void test_template(void)
+{
+	struct device *dev = dev_up("eth14", 1);
+	struct sock *sk = harness_sock();
+	unsigned long g = harness_group(300);
+	unsigned char mac[ETH_ALEN];
+	unsigned long rebuilds = hs.rebuilds, builds;
+	int i;
+
+	CHECK(ip_mc_join_group(sk, dev, g) == 0);
+	builds = hs.ip_builds;
+	reset_frames();
+	for (i = 0; i < 5; i++)
+	{
+		harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 10, 0);
+		harness_tick(HZ);
+	}
+	CHECK(count_frames(0x16, g) == 5);
+	CHECK(hs.ip_builds == builds);
+	harness_mc_map(g, mac);
+	for (i = 0; i < nframes; i++)
+		CHECK(frames[i].csum_ok && memcmp(frames[i].mac, mac, ETH_ALEN) == 0);
+	/* Leaves go to all routers with a header of their own */
+	reset_frames();
+	CHECK(ip_mc_leave_group(sk, dev, g) == 0);
+	CHECK(ip_mc_join_group(sk, dev, g) == 0);
+	CHECK(ip_mc_leave_group(sk, dev, g) == 0);
+	CHECK(count_frames(IGMP_HOST_LEAVE_MESSAGE, g) == 2);
+	harness_mc_map(htonl(0xE0000002), mac);
+	for (i = 0; i < nframes; i++)
+		if (frames[i].type == IGMP_HOST_LEAVE_MESSAGE)
+			CHECK(frames[i].csum_ok && memcmp(frames[i].mac, mac, ETH_ALEN) == 0);
+	CHECK(hs.rebuilds == rebuilds);
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* Hearing another member's report cancels ours */
+static void test_suppression(void)
+{
+	struct device *dev = dev_up("eth4", 1);
+	struct sock *sk = harness_sock();
+	unsigned long c0[4], c1[4];
+	int i;
+
+	for (i = 0; i < 10; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(300 + i)) == 0);
+	reset_frames();
+	igmp_counters(c0);
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 0, 0);
+	for (i = 0; i < 5; i++)
+		harness_igmp(dev, harness_group(300 + i), IGMP_HOST_MEMBERSHIP_REPORT, 0,
+			harness_group(300 + i));
+	/* A report that isn't sent to its group is ignored */
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_REPORT, 0, harness_group(305));
+	harness_tick(10 * HZ);
+	CHECK(nframes == 5);
+	for (i = 0; i < 5; i++)
+		CHECK(count_frames(IGMP_HOST_MEMBERSHIP_REPORT, harness_group(300 + i)) == 0);
+	igmp_counters(c1);
+	CHECK(c1[0] - c0[0] == 1);
+	CHECK(c1[1] - c0[1] == 5);
+	CHECK(c1[2] - c0[2] == 5);
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* A v3 general query is answered for the whole interface in one report */
+static void test_query_v3(void)
+{
+	struct device *dev = dev_up("eth5", 1);
+	struct sock *sk = harness_sock(), *ssm = harness_sock();
+	struct harness_v3_query q;
+	int i;
+
+	CHECK(sizeof(q) == 12);
+	for (i = 0; i < 30; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(400 + i)) == 0);
+	/* One more group with two sources */
+	CHECK(ip_mc_source(ssm, dev, harness_group(430), htonl(0x0A000101), 1, MCAST_INCLUDE) == 0);
+	CHECK(ip_mc_source(ssm, dev, harness_group(430), htonl(0x0A000102), 1, MCAST_INCLUDE) == 0);
+	memset(&q, 0, sizeof(q));
+	q.type = IGMP_HOST_MEMBERSHIP_QUERY;
+	q.code = 10;
+	q.csum = ip_compute_csum((unsigned char *)&q, sizeof(q));
+	reset_frames();
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	harness_tick(HZ + 1);
+	CHECK(nframes == 1);
+	CHECK(frames[0].type == 0x22);
+	CHECK(frames[0].daddr == htonl(0xE0000016));
+	CHECK(frames[0].csum_ok);
+	/* ngrec is the second word after the checksum */
+	CHECK(nframes == 1 && ntohs(frames[0].group >> 16) == 31);
+	/* 8 byte header, 8 byte records, 4 bytes a source */
+	CHECK(nframes == 1 && frames[0].len == 8 + 31 * 8 + 2 * 4);
+	ip_mc_drop_socket(sk);
+	ip_mc_drop_socket(ssm);
+	harness_sock_free(sk);
+	harness_sock_free(ssm);
+	dev_down(dev);
+	drain();
+}
+
+/*
+ * An older querier holds the host to its version for 260 seconds after
+ * its last query, and cancels a v3 report already pending.
+ */
+static void test_older_querier(void)
+{
+	struct device *dev = dev_up("eth17", 1);
+	struct sock *sk = harness_sock();
+	struct harness_v3_query q;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(0xA00 + i)) == 0);
+	memset(&q, 0, sizeof(q));
+	q.type = IGMP_HOST_MEMBERSHIP_QUERY;
+	q.code = 100;
+	q.csum = ip_compute_csum((unsigned char *)&q, sizeof(q));
+	drain();
+
+	/* v3 report pending, then a v2 querier speaks */
+	reset_frames();
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 10, 0);
+	drain();
+	CHECK(count_frames(0x22, 0) == 0);
+	CHECK(count_frames(0x16, 0) == 5);
+
+	/* The v3 querier is answered in v2 while the v2 one is about */
+	harness_tick(100 * HZ);
+	reset_frames();
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	drain();
+	CHECK(count_frames(0x22, 0) == 0);
+	CHECK(count_frames(0x16, 0) == 5);
+
+	/* v1 beats v2 */
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 0, 0);
+	drain();
+	reset_frames();
+	harness_igmp(dev, IGMP_ALL_HOSTS, IGMP_HOST_MEMBERSHIP_QUERY, 10, 0);
+	drain();
+	CHECK(count_frames(IGMP_HOST_MEMBERSHIP_REPORT, 0) == 5);
+
+	/* Both gone quiet: back to v3 */
+	harness_tick(260 * HZ);
+	reset_frames();
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	drain();
+	CHECK(count_frames(0x22, 0) == 1);
+	CHECK(count_frames(0x16, 0) == 0 && count_frames(IGMP_HOST_MEMBERSHIP_REPORT, 0) == 0);
+
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* Source filters: INCLUDE and EXCLUDE users of one group */
+static void test_sources(void)
+{
+	struct device *dev = dev_up("eth6", 1);
+	struct sock *a = harness_sock(), *b = harness_sock();
+	unsigned long g = harness_group(500);
+	unsigned long s1 = htonl(0x0A000101), s2 = htonl(0x0A000102), s3 = htonl(0x0A000103);
+
+	CHECK(ip_mc_source(a, dev, g, s1, 1, MCAST_INCLUDE) == 0);
+	CHECK(ip_mc_source(a, dev, g, s2, 1, MCAST_INCLUDE) == 0);
+	CHECK(ip_mc_source_ok(dev, g, s1));
+	CHECK(!ip_mc_source_ok(dev, g, s3));
+	CHECK(ip_mc_sf_allow(a, dev, g, s2));
+	CHECK(!ip_mc_sf_allow(a, dev, g, s3));
+	/* An ordinary join makes the interface EXCLUDE nothing */
+	CHECK(ip_mc_join_group(b, dev, g) == 0);
+	CHECK(ip_mc_source_ok(dev, g, s3));
+	CHECK(ip_mc_source(b, dev, g, s3, 1, MCAST_EXCLUDE) == 0);
+	CHECK(!ip_mc_source_ok(dev, g, s3));
+	CHECK(!ip_mc_sf_allow(b, dev, g, s3));
+	CHECK(ip_mc_sf_allow(b, dev, g, s1));
+	/* Dropping the last included source leaves */
+	ip_mc_drop_socket(b);
+	CHECK(ip_mc_source(a, dev, g, s1, 0, MCAST_INCLUDE) == 0);
+	CHECK(ip_mc_source(a, dev, g, s2, 0, MCAST_INCLUDE) == 0);
+	CHECK(!ip_mc_source_ok(dev, g, s2));
+	CHECK(dev->mc_count == 1);
+	ip_mc_drop_socket(a);
+	harness_sock_free(a);
+	harness_sock_free(b);
+	dev_down(dev);
+}
+
+/*
+ * igmp_rcv sums 8 byte messages inline. Throw random headers at it and
+ * check it takes exactly those that ip_compute_csum, the general routine
+ * it used to call, passes.
+ */
+static int taken(struct device *dev, struct igmphdr *igh, int len, int ttl)
+{
+	unsigned long c0[4], c1[4];
+
+	igmp_counters(c0);
+	harness_rcv(dev, igh->group ? igh->group : IGMP_ALL_HOSTS, htonl(0x0A000001), igh, len, ttl);
+	igmp_counters(c1);
+	return c1[0] != c0[0];
+}
+
+static void test_csum(void)
+{
+	struct device *dev = dev_up("eth7", 1);
+	struct igmphdr igh;
+	unsigned char *p = (unsigned char *)&igh;
+	unsigned short *w = (unsigned short *)&igh;
+	int i, k, good, mismatch = 0, ngood = 0;
+
+	srand(1);
+	for (i = 0; i < 200000; i++)
+	{
+		for (k = 0; k < 8; k++)
+			p[k] = rand();
+		igh.type = IGMP_HOST_MEMBERSHIP_QUERY;
+		if (i % 4 < 2)
+		{
+			igh.csum = 0;
+			igh.csum = ip_compute_csum(p, 8);
+		}
+		if (i % 4 == 1)
+		{
+			/* One bit off, anywhere */
+			k = rand() % 64;
+			p[k / 8] ^= 1 << (k % 8);
+		}
+		good = ip_compute_csum(p, 8) == 0 && igh.type == IGMP_HOST_MEMBERSHIP_QUERY;
+		if (taken(dev, &igh, 8, 1) != good)
+			mismatch++;
+		ngood += good;
+	}
+	CHECK(mismatch == 0);
+	CHECK(ngood > 50000);
+
+	/* Words that sum to zero: a checksum of 0 and of 0xFFFF are both right */
+	igh.type = IGMP_HOST_MEMBERSHIP_QUERY;
+	igh.unused = 0;
+	w[2] = 0;
+	w[3] = 0xFFFF - w[0];
+	igh.csum = 0;
+	CHECK(ip_compute_csum(p, 8) == 0);
+	CHECK(taken(dev, &igh, 8, 1));
+	igh.csum = 0xFFFF;
+	CHECK(ip_compute_csum(p, 8) == 0);
+	CHECK(taken(dev, &igh, 8, 1));
+
+	/* Only a TTL of 1 is taken, and never a short message */
+	CHECK(!taken(dev, &igh, 8, 2));
+	CHECK(!taken(dev, &igh, 6, 1));
+	dev_down(dev);
+	drain();
+}
+
+/* Lots of groups: the indexes grow and everything is found again */
+static void test_many(void)
+{
+	struct device *dev = dev_up("eth8", 1);
+	struct sock *sk = harness_sock();
+	int i, n = 20000, bad = 0;
+
+	harness_quiet = 1;
+	for (i = 0; i < n; i++)
+		if (ip_mc_join_group(sk, dev, harness_group(10000 + i)) != 0)
+			bad++;
+	CHECK(bad == 0);
+	CHECK(dev->mc_count == n + 1);
+	for (i = 0; i < n; i++)
+		if (!ip_mc_source_ok(dev, harness_group(10000 + i), 1))
+			bad++;
+	CHECK(bad == 0);
+	for (i = 0; i < n; i += 2)
+		if (ip_mc_leave_group(sk, dev, harness_group(10000 + i)) != 0)
+			bad++;
+	CHECK(bad == 0);
+	CHECK(dev->mc_count == n / 2 + 1);
+	for (i = 0; i < n; i++)
+		if (ip_mc_source_ok(dev, harness_group(10000 + i), 1) != (i & 1))
+			bad++;
+	CHECK(bad == 0);
+	ip_mc_drop_socket(sk);
+	CHECK(dev->mc_count == 1);
+	harness_sock_free(sk);
+	dev_down(dev);
+	harness_quiet = 0;
+}
+
+/* Running out of memory loses the join but nothing else */
+static void test_nomem(void)
+{
+	struct device *dev = dev_up("eth9", 1);
+	struct sock *sk = harness_sock();
+	unsigned long g = harness_group(600);
+	int i, ok = 0;
+
+	harness_quiet = 1;
+	for (i = 1; i < 10; i++)
+	{
+		harness_fail_after = i;
+		if (ip_mc_join_group(sk, dev, g) == 0)
+		{
+			ok++;
+			CHECK(ip_mc_leave_group(sk, dev, g) == 0);
+		}
+	}
+	harness_fail_after = 0;
+	CHECK(ok > 0);
+	CHECK(ip_mc_join_group(sk, dev, g) == 0);
+	CHECK(ip_mc_source_ok(dev, g, 1));
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	harness_quiet = 0;
+}
+
+/* A source that can't be added is refused and leaves no trace */
+static void test_nomem_sources(void)
+{
+	long live = hs.live;
+	struct device *dev = dev_up("eth13", 1);
+	struct sock *a = harness_sock(), *b = harness_sock();
+	unsigned long g = harness_group(601);
+	unsigned long s1 = htonl(0x0A000101), s2 = htonl(0x0A000102), s3 = htonl(0x0A000103);
+	int i, err, ok = 0;
+
+	harness_quiet = 1;
+	for (i = 1; i < 10; i++)
+	{
+		harness_fail_after = i;
+		err = ip_mc_source(a, dev, g, s1, 1, MCAST_INCLUDE);
+		harness_fail_after = 0;
+		if (err == 0)
+		{
+			ok++;
+			CHECK(ip_mc_source_ok(dev, g, s1));
+			CHECK(ip_mc_leave_group(a, dev, g) == 0);
+		}
+		else
+			CHECK(err == -ENOMEM);
+		CHECK(!ip_mc_source_ok(dev, g, s1));
+		CHECK(dev->mc_count == 1);
+	}
+	CHECK(ok > 0);
+
+	/* The membership is there, the new source is not */
+	CHECK(ip_mc_source(a, dev, g, s1, 1, MCAST_INCLUDE) == 0);
+	harness_fail_after = 1;
+	CHECK(ip_mc_source(a, dev, g, s2, 1, MCAST_INCLUDE) == -ENOMEM);
+	harness_fail_after = 0;
+	CHECK(!ip_mc_source_ok(dev, g, s2));
+	CHECK(!ip_mc_sf_allow(a, dev, g, s2));
+	CHECK(ip_mc_source(a, dev, g, s2, 1, MCAST_INCLUDE) == 0);
+	CHECK(ip_mc_source_ok(dev, g, s2));
+
+	/* A second member bringing its own source fails alone */
+	for (i = 1; i < 10; i++)
+	{
+		harness_fail_after = i;
+		err = ip_mc_source(b, dev, g, s3, 1, MCAST_INCLUDE);
+		harness_fail_after = 0;
+		if (err == 0)
+			break;
+		CHECK(err == -ENOMEM);
+		CHECK(!ip_mc_source_ok(dev, g, s3));
+		CHECK(ip_mc_source_ok(dev, g, s1));
+	}
+	CHECK(err == 0);
+	CHECK(ip_mc_source_ok(dev, g, s3));
+	ip_mc_drop_socket(a);
+	ip_mc_drop_socket(b);
+	CHECK(dev->mc_count == 1);
+	drain();
+	harness_sock_free(a);
+	harness_sock_free(b);
+	dev_down(dev);
+	CHECK(hs.live == live);
+	harness_quiet = 0;
+}
+
+/*
+ * Joins sleep in their allocations. race() runs another join from the
+ * race_at'th of them, as if it had got in then: of the same group, or
+ * with race_alias of another group on the same MAC address.
+ */
+static struct sock *racer;
+static struct device *race_dev;
+static unsigned long race_group, race_source;
+static int race_at, race_calls, race_alias;
+
+static unsigned long alias(unsigned long g)
+{
+	return htonl(ntohl(g) ^ 0x00800000);	/* Bit 23 is not in the MAC */
+}
+
+static void race(int size)
+{
+	if (++race_calls != race_at)
+		return;
+	if (race_group == IGMP_ALL_HOSTS)
+		ip_mc_allhost(race_dev);
+	else if (race_alias)
+		CHECK(ip_mc_join_group(racer, race_dev, alias(race_group)) == 0);
+	else
+		CHECK(ip_mc_source(racer, race_dev, race_group, race_source, 1, MCAST_INCLUDE) == 0);
+}
+
+static int groups_on(struct device *dev, unsigned long g, int *users)
+{
+	struct ip_mc_list *im;
+	int n = 0;
+
+	*users = 0;
+	for (im = dev->ip_mc_list; im != NULL; im = im->next)
+		if (im->multiaddr == g)
+		{
+			*users = im->users;
+			n++;
+		}
+	return n;
+}
+
+static int macs_on(struct device *dev, unsigned long g, int *users)
+{
+	struct dev_mc_list *dmi;
+	unsigned char mac[ETH_ALEN];
+	int n = 0;
+
+	harness_mc_map(g, mac);
+	*users = 0;
+	for (dmi = dev->mc_list; dmi != NULL; dmi = dmi->next)
+		if (memcmp(dmi->dmi_addr, mac, ETH_ALEN) == 0)
+		{
+			*users = dmi->dmi_users;
+			n++;
+		}
+	return n;
+}
+
+/*
+ * Every allocation of ip_mc_allhost, and of a join: the first on the
+ * device, so its state is made, the second, or the seventeenth address
+ * so the packed array grows.
+ */
+static void test_race(void)
+{
+	long live = hs.live;
+	unsigned long mismatch = hs.size_mismatch;
+	struct device *dev;
+	struct sock *sk = harness_sock();
+	unsigned long s1 = htonl(0x0A000101);
+	int users, raced, fill, all, i;
+
+	racer = harness_sock();
+	harness_quiet = 1;
+	for (fill = -1; fill <= 15; fill += fill < 0 ? 1 : 15)
+	for (race_alias = 0; race_alias < 2; race_alias++)
+	for (race_at = 1; race_at < 40; race_at++)
+	{
+		dev = race_dev = harness_dev("eth15", htonl(0x0A000001), 1);
+		all = fill >= 0;
+		if (all)
+		{
+			race_group = IGMP_ALL_HOSTS;
+			race_calls = 0;
+			harness_sleep = race;
+			ip_mc_allhost(dev);
+			harness_sleep = NULL;
+			CHECK(groups_on(dev, IGMP_ALL_HOSTS, &users) == 1);
+			CHECK(dev->mc_count == 1);
+		}
+		for (i = 0; i < fill; i++)
+			CHECK(ip_mc_join_group(sk, dev, harness_group(0x880 + i)) == 0);
+
+		race_group = harness_group(0x800 + race_at);
+		race_source = s1;
+		race_calls = 0;
+		harness_sleep = race;
+		CHECK(ip_mc_source(sk, dev, race_group, s1, 1, MCAST_INCLUDE) == 0);
+		harness_sleep = NULL;
+		raced = race_calls >= race_at;
+		CHECK(groups_on(dev, race_group, &users) == 1);
+		CHECK(users == 1 + (raced && !race_alias));
+		CHECK(groups_on(dev, alias(race_group), &users) == (raced && race_alias));
+		CHECK(macs_on(dev, race_group, &users) == 1);
+		CHECK(users == 1 + (raced && race_alias));
+		CHECK(dev->mc_count == all + (all ? fill : 0) + 1);
+		CHECK(ip_mc_leave_group(sk, dev, race_group) == 0);
+		CHECK(ip_mc_source_ok(dev, race_group, s1) == (raced && !race_alias));
+		ip_mc_drop_socket(racer);
+		CHECK(groups_on(dev, race_group, &users) == 0);
+		CHECK(macs_on(dev, race_group, &users) == 0);
+		ip_mc_drop_socket(sk);
+		dev_down(dev);
+	}
+	harness_sock_free(sk);
+	harness_sock_free(racer);
+	drain();
+	CHECK(hs.live == live);
+	CHECK(hs.size_mismatch == mismatch);
+	harness_quiet = 0;
+}
+
+/* The Pool hits/misses/drops line of /proc/net/igmp */
+static void pool_counters(unsigned long *c)
+{
+	char buf[512], *start, *p;
+
+	igmp_get_info(buf, &start, 0, sizeof(buf), 0);
+	p = strstr(buf, "Pool ");
+	if (p == NULL || sscanf(p, "Pool %lu hits %lu misses %lu drops", &c[0], &c[1], &c[2]) != 3)
+		memset(c, 0, 3 * sizeof(*c));
+}
+
+/*
+ * A v3 report for the whole interface that can't get its buffer goes
+ * out in reserve buffers instead, and a small one starts there.
+ */
+static void test_reserve(void)
+{
+	struct device *dev = dev_up("eth16", 1);
+	struct sock *sk = harness_sock();
+	struct harness_v3_query q;
+	unsigned long c0[3], c1[3];
+	int i, n;
+
+	memset(&q, 0, sizeof(q));
+	q.type = IGMP_HOST_MEMBERSHIP_QUERY;
+	q.code = 10;
+	q.csum = ip_compute_csum((unsigned char *)&q, sizeof(q));
+	for (i = 0; i < 10; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(0x900 + i)) == 0);
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	drain();
+	pool_counters(c0);
+	reset_frames();
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	harness_tick(HZ + 1);
+	pool_counters(c1);
+	CHECK(nframes == 1 && ntohs(frames[0].group >> 16) == 10);
+	CHECK(c1[0] - c0[0] == 1 && c1[1] == c0[1]);
+
+	for (; i < 60; i++)
+		CHECK(ip_mc_join_group(sk, dev, harness_group(0x900 + i)) == 0);
+	drain();
+	pool_counters(c0);
+	reset_frames();
+	harness_skb_max = 256;
+	harness_rcv(dev, IGMP_ALL_HOSTS, htonl(0x0A000001), &q, sizeof(q), 1);
+	harness_tick(HZ + 1);
+	harness_skb_max = 0;
+	pool_counters(c1);
+	CHECK(nframes > 1);
+	for (i = 0, n = 0; i < nframes; i++)
+	{
+		CHECK(frames[i].type == 0x22 && frames[i].csum_ok);
+		n += ntohs(frames[i].group >> 16);
+	}
+	CHECK(n == 60);
+	CHECK(c1[0] - c0[0] == nframes && c1[2] == c0[2]);
+	ip_mc_drop_socket(sk);
+	harness_sock_free(sk);
+	dev_down(dev);
+	drain();
+}
+
+/* set_multicast_list sees the packed list, or nothing while delayed */
+static void test_upload(void)
+{
+	struct device *dev = dev_up("eth10", 1);
+	struct harness_dev *hd = HARNESS_DEV(dev);
+	unsigned char mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x7f, 0, 0 };
+	unsigned long up;
+	int i;
+
+	up = hd->uploads;
+	for (i = 0; i < 10; i++)
+	{
+		mac[5] = i;
+		dev_mc_add(dev, mac, ETH_ALEN, 0);
+	}
+	CHECK(hd->uploads - up == 10);
+	CHECK(hd->mc_num == 11);
+	dev_mc_add(dev, mac, ETH_ALEN, 0);
+	CHECK(hd->uploads - up == 10);
+
+	/* Held back while batched, one upload at the end */
+	CHECK(dev_mc_batch_begin(dev) == 0);
+	for (i = 0; i < 10; i++)
+	{
+		mac[5] = i;
+		dev_mc_delete(dev, mac, ETH_ALEN, 0);
+	}
+	CHECK(hd->uploads - up == 10);
+	dev_mc_batch_end(dev);
+	CHECK(hd->uploads - up == 11);
+	CHECK(hd->mc_num == 2);
+
+	/* And with a delay, by the timer */
+	CHECK(dev_mc_set_delay(dev, 5) == 0);
+	dev_mc_delete(dev, mac, ETH_ALEN, 0);
+	CHECK(hd->uploads - up == 11);
+	harness_tick(5);
+	CHECK(hd->uploads - up == 12);
+	CHECK(hd->mc_num == 1);
+	CHECK(dev_mc_set_delay(dev, 0) == 0);
+	dev_down(dev);
+}
+
+/*
+ * IFF_ALLMULTI only reaches drivers that take DEV_MC_ALLMULTI; the rest
+ * would go promiscuous and get the list. Past the cap everyone is asked
+ * for all multicast.
+ */
+static void test_allmulti(void)
+{
+	struct device *dev = dev_up("eth13", 1);
+	struct harness_dev *hd = HARNESS_DEV(dev);
+	unsigned char mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x7d, 0, 1 };
+
+	dev->flags |= IFF_ALLMULTI;
+	dev_mc_add(dev, mac, ETH_ALEN, 0);
+	CHECK(hd->mc_num == 2);
+	CHECK(dev_mc_set_allmulti(dev, 1) == 0);
+	CHECK(hd->mc_num == DEV_MC_ALLMULTI);
+	CHECK(dev_mc_set_allmulti(dev, 0) == 0);
+	CHECK(hd->mc_num == 2);
+	dev->flags &= ~IFF_ALLMULTI;
+
+	CHECK(dev_mc_set_limit(dev, 1) == 0);
+	CHECK(hd->mc_num == DEV_MC_ALLMULTI);
+	dev_mc_delete(dev, mac, ETH_ALEN, 0);
+	CHECK(hd->mc_num == 1);
+	CHECK(dev_mc_set_limit(dev, 0) == 0);
+	dev_down(dev);
+}
+
+/*
+ * Each device holds back uploads for its own delay, a closing socket
+ * uploads once per device, and taking a device down frees everything,
+ * a held back upload included.
+ */
+static void test_teardown(void)
+{
+	struct device *a, *b, *c;
+	struct sock *sk = harness_sock();
+	unsigned char mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x7e, 0, 1 };
+	unsigned long ua, ub;
+	char buf[1024], *start;
+	long live = hs.live;
+	int i;
+
+	a = dev_up("eth11", 1);
+	b = dev_up("eth12", 1);
+	CHECK(dev_mc_set_delay(a, 2) == 0);
+	CHECK(dev_mc_set_delay(b, 20) == 0);
+	ua = HARNESS_DEV(a)->uploads;
+	ub = HARNESS_DEV(b)->uploads;
+	dev_mc_add(b, mac, ETH_ALEN, 0);
+	dev_mc_add(a, mac, ETH_ALEN, 0);
+	harness_tick(2);
+	CHECK(HARNESS_DEV(a)->uploads - ua == 1);
+	CHECK(HARNESS_DEV(b)->uploads - ub == 0);
+	harness_tick(18);
+	CHECK(HARNESS_DEV(b)->uploads - ub == 1);
+	CHECK(dev_mc_set_delay(a, 0) == 0);
+	CHECK(dev_mc_set_delay(b, 0) == 0);
+
+	for (i = 0; i < 10; i++)
+	{
+		CHECK(ip_mc_join_group(sk, a, harness_group(0x700 + i)) == 0);
+		CHECK(ip_mc_join_group(sk, b, harness_group(0x700 + i)) == 0);
+	}
+	ua = HARNESS_DEV(a)->uploads;
+	ub = HARNESS_DEV(b)->uploads;
+	/* A device with no MAC list is not batched, or given one */
+	c = harness_dev("sl0", htonl(0x0A000001), 0);
+	ip_mc_allhost(c);
+	CHECK(ip_mc_join_group(sk, c, harness_group(0x700)) == 0);
+	ip_mc_drop_socket(sk);
+	CHECK(HARNESS_DEV(a)->uploads - ua == 1);
+	CHECK(HARNESS_DEV(b)->uploads - ub == 1);
+	CHECK(HARNESS_DEV(a)->mc_num == 2);
+	dev_mc_get_info(buf, &start, 0, sizeof(buf), 0);
+	CHECK(strstr(buf, "sl0") == NULL);
+	dev_down(c);
+	harness_sock_free(sk);
+	drain();
+
+	/* Down with an upload still held back */
+	CHECK(dev_mc_set_delay(a, 50) == 0);
+	dev_mc_delete(a, mac, ETH_ALEN, 0);
+	CHECK(harness_timers_pending());
+	dev_down(a);
+	dev_down(b);
+	CHECK(!harness_timers_pending());
+	CHECK(hs.live == live);
+	dev_mc_get_info(buf, &start, 0, sizeof(buf), 0);
+	CHECK(strstr(buf, "eth11") == NULL && strstr(buf, "eth12") == NULL);
+}
+
+static struct
+{
+	const char *name;
+	void (*fn)(void);
+} tests[] = {
+	{ "join_leave", test_join_leave },
+	{ "shared_group", test_shared_group },
+	{ "query_v1", test_query_v1 },
+	{ "query_v2", test_query_v2 },
+	{ "template", test_template },
+	{ "suppression", test_suppression },
+	{ "query_v3", test_query_v3 },
+	{ "older_querier", test_older_querier },
+	{ "sources", test_sources },
+	{ "csum", test_csum },
+	{ "many", test_many },
+	{ "nomem", test_nomem },
+	{ "nomem_sources", test_nomem_sources },
+	{ "race", test_race },
+	{ "reserve", test_reserve },
+	{ "upload", test_upload },
+	{ "allmulti", test_allmulti },
+	{ "teardown", test_teardown },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int ran = 0, before;
+
+	harness_xmit = capture;
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		if (argc > 1 && strcmp(argv[1], tests[i].name) != 0)
+			continue;
+		before = failures;
+		tests[i].fn();
+		printf("%-16s %s\n", tests[i].name, failures == before ? "ok" : "FAIL");
+		ran++;
+	}
+	if (ran == 0)
+	{
+		fprintf(stderr, "no test %s\n", argv[1]);
+		return 2;
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,554 @@
+/*
+ * Kernel services for igmp.c and dev_mcast.c in userspace. See
+ * harness.h for what is provided.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "harness.h"
+
+#define HS_INC(f)	__atomic_fetch_add(&hs.f, 1, __ATOMIC_RELAXED)
+
+struct harness_stats hs;
+int harness_fail_after;
+unsigned int harness_skb_max;
+void (*harness_sleep)(int size);
+void (*harness_xmit)(struct device *dev, struct sk_buff *skb);
+int harness_quiet;
+
+volatile unsigned long jiffies;
+unsigned long intr_count;
+
+uint64_t harness_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Memory. Each block carries its size so kfree_s can check the size it
+ * is given, the way the kernel allocator trusts it.
+ */
+
+struct kblock
+{
+	unsigned long size;
+	unsigned long magic;
+};
+
+#define KMAGIC	0x6b6d616cUL
+
+void *kmalloc(unsigned int size, int priority)
+{
+	struct kblock *b;
+
+	if (priority == GFP_KERNEL && harness_sleep != NULL)
+		harness_sleep(size);
+	if (harness_fail_after && --harness_fail_after == 0)
+	{
+		hs.kmalloc_fails++;
+		return NULL;
+	}
+	b = malloc(sizeof(*b) + size);
+	if (b == NULL)
+		return NULL;
+	b->size = size;
+	b->magic = KMAGIC;
+	hs.kmallocs++;
+	hs.live++;
+	hs.live_bytes += size;
+	return b + 1;
+}
+
+void kfree_s(void *obj, int size)
+{
+	struct kblock *b = (struct kblock *)obj - 1;
+
+	if (obj == NULL)
+		return;
+	if (b->magic != KMAGIC)
+	{
+		fprintf(stderr, "kfree_s: %p was not from kmalloc\n", obj);
+		abort();
+	}
+	if (size && (unsigned long)size != b->size)
+		hs.size_mismatch++;
+	b->magic = 0;
+	hs.kfrees++;
+	hs.live--;
+	hs.live_bytes -= b->size;
+	free(b);
+}
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n = 0;
+
+	hs.printks++;
+	if (!harness_quiet)
+	{
+		va_start(ap, fmt);
+		n = vfprintf(stderr, fmt, ap);
+		va_end(ap);
+	}
+	return n;
+}
+
+/*
+ * Interrupts. cli() takes the global lock and waits for every other
+ * thread to leave its bottom half; a bottom half can't start while the
+ * lock is held. flags remember whether the lock was already ours.
+ */
+
+#define MAX_CPUS	64
+
+static struct
+{
+	volatile int in_bh;
+} __attribute__((aligned(64))) cpu[MAX_CPUS];
+
+static int ncpus = 1;
+static __thread int self;
+static volatile int cli_owner = -1;
+
+void harness_thread_init(void)
+{
+	self = __atomic_fetch_add(&ncpus, 1, __ATOMIC_SEQ_CST);
+	if (self >= MAX_CPUS)
+	{
+		fprintf(stderr, "harness: too many threads\n");
+		abort();
+	}
+}
+
+void harness_bh_enter(void)
+{
+	__atomic_store_n(&cpu[self].in_bh, 1, __ATOMIC_SEQ_CST);
+	while (1)
+	{
+		int owner = __atomic_load_n(&cli_owner, __ATOMIC_SEQ_CST);
+		if (owner == -1 || owner == self)
+			return;
+		__atomic_store_n(&cpu[self].in_bh, 0, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&cli_owner, __ATOMIC_ACQUIRE) != -1)
+			__builtin_ia32_pause();
+		__atomic_store_n(&cpu[self].in_bh, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void harness_bh_exit(void)
+{
+	__atomic_store_n(&cpu[self].in_bh, 0, __ATOMIC_RELEASE);
+}
+
+unsigned long harness_save_flags(void)
+{
+	return __atomic_load_n(&cli_owner, __ATOMIC_RELAXED) == self;
+}
+
+void harness_cli(void)
+{
+	int bh = cpu[self].in_bh, i, n, none;
+
+	if (__atomic_load_n(&cli_owner, __ATOMIC_RELAXED) == self)
+		return;
+	/* Out of our own bottom half while we wait, or two of them deadlock */
+	if (bh)
+		__atomic_store_n(&cpu[self].in_bh, 0, __ATOMIC_SEQ_CST);
+	while (1)
+	{
+		none = -1;
+		if (__atomic_compare_exchange_n(&cli_owner, &none, self, 0,
+		    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			break;
+		__builtin_ia32_pause();
+	}
+	n = __atomic_load_n(&ncpus, __ATOMIC_SEQ_CST);
+	for (i = 0; i < n; i++)
+		while (i != self && __atomic_load_n(&cpu[i].in_bh, __ATOMIC_SEQ_CST))
+			__builtin_ia32_pause();
+	if (bh)
+		cpu[self].in_bh = 1;
+}
+
+void harness_restore_flags(unsigned long flags)
+{
+	if (!flags && cli_owner == self)
+		__atomic_store_n(&cli_owner, -1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Timers. As in the kernel, expires is relative when add_timer is
+ * called and the pending list is kept sorted, so arming a timer costs
+ * a walk of the ones due before it.
+ */
+
+static struct timer_list timer_head = { &timer_head, &timer_head, ~0UL, 0, NULL };
+
+void init_timer(struct timer_list *timer)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+void add_timer(struct timer_list *timer)
+{
+	struct timer_list *p = &timer_head;
+
+	timer->expires += jiffies;
+	do
+		p = p->next;
+	while (p != &timer_head && timer->expires >= p->expires);
+	timer->next = p;
+	timer->prev = p->prev;
+	p->prev->next = timer;
+	p->prev = timer;
+	hs.timers_added++;
+}
+
+int del_timer(struct timer_list *timer)
+{
+	if (timer->next == NULL)
+		return 0;
+	timer->next->prev = timer->prev;
+	timer->prev->next = timer->next;
+	timer->next = NULL;
+	timer->prev = NULL;
+	return 1;
+}
+
+int harness_timers_pending(void)
+{
+	return timer_head.next != &timer_head;
+}
+
+void harness_tick(unsigned long n)
+{
+	struct timer_list *t;
+
+	while (n--)
+	{
+		jiffies++;
+		harness_bh_enter();
+		while ((t = timer_head.next) != &timer_head && t->expires <= jiffies)
+		{
+			del_timer(t);
+			hs.timers_fired++;
+			t->function(t->data);
+		}
+		harness_bh_exit();
+	}
+}
+
+/*
+ * Buffers
+ */
+
+struct sk_buff *alloc_skb(unsigned int size, int priority)
+{
+	struct sk_buff *skb;
+
+	if (priority == GFP_KERNEL && harness_sleep != NULL)
+		harness_sleep(size);
+	if (priority == GFP_ATOMIC && harness_skb_max && size > harness_skb_max)
+		return NULL;
+	skb = calloc(1, sizeof(*skb) + size);
+	if (skb == NULL)
+		return NULL;
+	skb->data = (unsigned char *)(skb + 1);
+	skb->mem_len = sizeof(*skb) + size;
+	HS_INC(skb_allocs);
+	return skb;
+}
+
+void kfree_skb(struct sk_buff *skb, int rw)
+{
+	HS_INC(skb_frees);
+	free(skb);
+}
+
+void skb_queue_head_init(struct sk_buff_head *list)
+{
+	list->next = (struct sk_buff *)list;
+	list->prev = (struct sk_buff *)list;
+	list->qlen = 0;
+}
+
+void skb_queue_tail(struct sk_buff_head *list, struct sk_buff *skb)
+{
+	skb->next = (struct sk_buff *)list;
+	skb->prev = list->prev;
+	list->prev->next = skb;
+	list->prev = skb;
+	list->qlen++;
+}
+
+struct sk_buff *skb_dequeue(struct sk_buff_head *list)
+{
+	struct sk_buff *skb = list->next;
+
+	if (skb == (struct sk_buff *)list)
+		return NULL;
+	list->next = skb->next;
+	skb->next->prev = (struct sk_buff *)list;
+	skb->next = NULL;
+	skb->prev = NULL;
+	list->qlen--;
+	return skb;
+}
+
+/*
+ * IP output. ip_build_header follows ip_send: the MAC header is built
+ * with no destination, which an Ethernet device answers with a negative
+ * length, leaving skb->arp clear for dev_queue_xmit to resolve. The
+ * route lookup the real one does is not modelled, so its cost is only
+ * visible in hs.ip_builds.
+ */
+
+unsigned short ip_compute_csum(unsigned char *buff, int len)
+{
+	unsigned long long sum = 0;
+	unsigned int w;
+
+	for (; len >= 4; len -= 4, buff += 4)
+	{
+		memcpy(&w, buff, 4);
+		sum += w;
+	}
+	if (len >= 2)
+	{
+		sum += *(unsigned short *)buff;
+		buff += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += *buff;
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return ~sum & 0xFFFF;
+}
+
+static int eth_header(unsigned char *buff, struct device *dev, unsigned short type,
+	void *daddr, void *saddr, unsigned len, struct sk_buff *skb)
+{
+	unsigned short proto = htons(type);
+
+	memcpy(buff + 6, saddr ? saddr : dev->dev_addr, ETH_ALEN);
+	memcpy(buff + 12, &proto, 2);
+	if (dev->flags & IFF_LOOPBACK)
+	{
+		memset(buff, 0, ETH_ALEN);
+		return dev->hard_header_len;
+	}
+	if (daddr)
+	{
+		memcpy(buff, daddr, ETH_ALEN);
+		return dev->hard_header_len;
+	}
+	return -dev->hard_header_len;
+}
+
+int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long daddr,
+	struct device **dev, int type, struct options *opt, int len, int tos, int ttl)
+{
+	struct iphdr *iph;
+	int mac = 0;
+
+	HS_INC(ip_builds);
+	if (*dev == NULL)
+		return -EINVAL;
+	if (saddr == 0)
+		saddr = (*dev)->pa_addr;
+	skb->dev = *dev;
+	skb->arp = 1;
+	if ((*dev)->hard_header)
+	{
+		mac = (*dev)->hard_header(skb->data, *dev, ETH_P_IP, NULL, NULL, len, skb);
+		if (mac < 0)
+		{
+			mac = -mac;
+			skb->arp = 0;
+			skb->raddr = daddr;
+		}
+	}
+	skb->saddr = saddr;
+	iph = (struct iphdr *)(skb->data + mac);
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = tos;
+	iph->ttl = ttl;
+	iph->protocol = type;
+	iph->saddr = saddr;
+	iph->daddr = daddr;
+	skb->ip_hdr = iph;
+	return mac + sizeof(*iph);
+}
+
+void harness_mc_map(unsigned long addr, unsigned char *mac)
+{
+	addr = ntohl(addr);
+	mac[0] = 0x01;
+	mac[1] = 0x00;
+	mac[2] = 0x5e;
+	mac[3] = (addr >> 16) & 0x7F;
+	mac[4] = (addr >> 8) & 0xFF;
+	mac[5] = addr & 0xFF;
+}
+
+void ip_queue_xmit(struct sock *sk, struct device *dev, struct sk_buff *skb, int free)
+{
+	static unsigned short ip_id;
+	struct iphdr *iph = (struct iphdr *)(skb->data + dev->hard_header_len);
+
+	skb->dev = dev;
+	skb->ip_hdr = iph;
+	iph->tot_len = htons(skb->len - dev->hard_header_len);
+	iph->id = htons(ip_id++);
+	iph->check = 0;
+	iph->check = ip_compute_csum((unsigned char *)iph, iph->ihl * 4);
+	if (!(dev->flags & IFF_UP))
+	{
+		kfree_skb(skb, FREE_WRITE);
+		return;
+	}
+	/* dev_queue_xmit: rebuild_header resolves a multicast destination */
+	if (!skb->arp)
+	{
+		HS_INC(rebuilds);
+		if (dev->type == ARPHRD_ETHER)
+			harness_mc_map(iph->daddr, skb->data);
+		skb->arp = 1;
+	}
+	HS_INC(xmits);
+	if (harness_xmit != NULL)
+		harness_xmit(dev, skb);
+	kfree_skb(skb, FREE_WRITE);
+}
+
+struct igmphdr *harness_frame_igmp(struct device *dev, struct sk_buff *skb, int *len)
+{
+	struct iphdr *iph = (struct iphdr *)(skb->data + dev->hard_header_len);
+
+	*len = ntohs(iph->tot_len) - iph->ihl * 4;
+	return (struct igmphdr *)((unsigned char *)iph + iph->ihl * 4);
+}
+
+/*
+ * Devices and sockets
+ */
+
+static void set_multicast_list(struct device *dev, int num_addrs, void *addrs)
+{
+	struct harness_dev *hd = HARNESS_DEV(dev);
+
+	hd->uploads++;
+	hd->mc_num = num_addrs;
+	hs.uploads++;
+}
+
+struct device *harness_dev(const char *name, unsigned long addr, int ether)
+{
+	struct harness_dev *hd = calloc(1, sizeof(*hd));
+	struct device *dev = &hd->dev;
+	unsigned long a = ntohl(addr);
+
+	snprintf(hd->name, sizeof(hd->name), "%s", name);
+	dev->name = hd->name;
+	dev->pa_addr = addr;
+	dev->flags = IFF_UP | IFF_RUNNING | IFF_BROADCAST | IFF_MULTICAST;
+	dev->mtu = 1500;
+	dev->set_multicast_list = set_multicast_list;
+	if (ether)
+	{
+		dev->type = ARPHRD_ETHER;
+		dev->hard_header = eth_header;
+		dev->hard_header_len = ETH_HLEN;
+		dev->addr_len = ETH_ALEN;
+		dev->dev_addr[0] = 0x02;
+		dev->dev_addr[2] = a >> 24;
+		dev->dev_addr[3] = a >> 16;
+		dev->dev_addr[4] = a >> 8;
+		dev->dev_addr[5] = a;
+	}
+	else
+		dev->type = 0x100;	/* ARPHRD_SLIP: no MAC header */
+	return dev;
+}
+
+void harness_dev_free(struct device *dev)
+{
+	free(HARNESS_DEV(dev));
+}
+
+struct sock *harness_sock(void)
+{
+	return calloc(1, sizeof(struct sock));
+}
+
+void harness_sock_free(struct sock *sk)
+{
+	free(sk);
+}
+
+/*
+ * Input, as ip_rcv hands a datagram to igmp_rcv.
+ */
+
+struct sk_buff *harness_igmp_skb(struct device *dev, unsigned long daddr, unsigned long saddr,
+	const void *igmp, int len, int ttl)
+{
+	struct sk_buff *skb = alloc_skb(sizeof(struct iphdr) + len, GFP_ATOMIC);
+	struct iphdr *iph = (struct iphdr *)skb->data;
+
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = ttl;
+	iph->protocol = IPPROTO_IGMP;
+	iph->saddr = saddr;
+	iph->daddr = daddr;
+	iph->tot_len = htons(sizeof(*iph) + len);
+	memcpy(iph + 1, igmp, len);
+	skb->dev = dev;
+	skb->ip_hdr = iph;
+	skb->h.raw = (unsigned char *)(iph + 1);
+	skb->len = sizeof(*iph) + len;
+	skb->saddr = saddr;
+	skb->daddr = daddr;
+	return skb;
+}
+
+void harness_rcv(struct device *dev, unsigned long daddr, unsigned long saddr,
+	const void *igmp, int len, int ttl)
+{
+	struct sk_buff *skb = harness_igmp_skb(dev, daddr, saddr, igmp, len, ttl);
+
+	harness_bh_enter();
+	igmp_rcv(skb, dev, NULL, daddr, len, saddr, 0, NULL);
+	harness_bh_exit();
+}
+
+void harness_igmphdr(struct igmphdr *igh, int type, int code, unsigned long group)
+{
+	igh->type = type;
+	igh->unused = code;
+	igh->csum = 0;
+	igh->group = group;
+	igh->csum = ip_compute_csum((unsigned char *)igh, sizeof(*igh));
+}
+
+void harness_igmp(struct device *dev, unsigned long daddr, int type, int code,
+	unsigned long group)
+{
+	struct igmphdr igh;
+
+	harness_igmphdr(&igh, type, code, group);
+	harness_rcv(dev, daddr, htonl(0x0A000001), &igh, sizeof(igh), 1);
+}
@@ -0,0 +1,130 @@
+/*
+ * Userspace harness for igmp.c and dev_mcast.c. The kernel files are
+ * built unmodified against the stub headers in include/, and harness.c
+ * supplies the kernel services they call:
+ *
+ *   - kmalloc/kfree_s with counters and fault injection
+ *   - timers on a virtual jiffies clock that only moves on harness_tick()
+ *   - sk_buffs, and an ip_build_header/ip_queue_xmit that hand every
+ *     frame to a capture hook instead of a driver
+ *   - Ethernet-like devices and sockets to drive the code with
+ *
+ * Interrupt masking follows the global cli() of the early SMP kernels:
+ * cli() excludes every thread that is inside harness_bh_enter/exit, and
+ * bottom half threads don't exclude each other. igmp_rcv and timers run
+ * as bottom halves.
+ */
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include "include/kern.h"
+#include "../dev_mcast.h"
+
+struct harness_stats
+{
+	unsigned long kmallocs;
+	unsigned long kfrees;
+	unsigned long kmalloc_fails;	/* Injected with harness_fail_after */
+	unsigned long size_mismatch;	/* kfree_s given the wrong size */
+	long live;			/* kmallocs not yet freed */
+	long live_bytes;
+	unsigned long skb_allocs;
+	unsigned long skb_frees;
+	unsigned long ip_builds;	/* ip_build_header calls */
+	unsigned long rebuilds;		/* Frames sent with the MAC header unresolved */
+	unsigned long xmits;
+	unsigned long timers_added;
+	unsigned long timers_fired;
+	unsigned long uploads;		/* set_multicast_list calls */
+	unsigned long printks;
+};
+
+extern struct harness_stats hs;
+
+/* Fail the kmalloc this many calls from now, 1 for the next; 0 is off */
+extern int harness_fail_after;
+
+/* GFP_ATOMIC sk_buffs bigger than this fail, as when memory is short; 0 is off */
+extern unsigned int harness_skb_max;
+
+/* Called wherever a GFP_KERNEL allocation could sleep */
+extern void (*harness_sleep)(int size);
+
+/* Sees every frame ip_queue_xmit would have sent, before it is freed */
+extern void (*harness_xmit)(struct device *dev, struct sk_buff *skb);
+
+/* Keep printk quiet */
+extern int harness_quiet;
+
+/* The driver behind a harness device */
+struct harness_dev
+{
+	struct device dev;		/* Must be first */
+	char name[16];
+	unsigned long uploads;
+	int mc_num;			/* Count given to the last upload */
+	void *user;
+};
+
+#define HARNESS_DEV(d)	((struct harness_dev *)(d))
+
+struct device *harness_dev(const char *name, unsigned long addr, int ether);
+void harness_dev_free(struct device *dev);
+struct sock *harness_sock(void);
+void harness_sock_free(struct sock *sk);
+
+/* Move the clock on n jiffies, running timers as they come due */
+void harness_tick(unsigned long n);
+int harness_timers_pending(void);
+
+/* Deliver an IGMP message to dev as the IP layer would */
+void harness_rcv(struct device *dev, unsigned long daddr, unsigned long saddr,
+	const void *igmp, int len, int ttl);
+void harness_igmp(struct device *dev, unsigned long daddr, int type, int code,
+	unsigned long group);
+
+/* The datagram harness_rcv would deliver, for the caller to pass to igmp_rcv */
+struct sk_buff *harness_igmp_skb(struct device *dev, unsigned long daddr, unsigned long saddr,
+	const void *igmp, int len, int ttl);
+
+/* An 8 byte IGMP message with its checksum */
+void harness_igmphdr(struct igmphdr *igh, int type, int code, unsigned long group);
+
+/* An IGMPv3 query without sources: 12 bytes, as on the wire */
+struct harness_v3_query
+{
+	unsigned char type;
+	unsigned char code;
+	unsigned short csum;
+	uint32_t group;
+	unsigned char qrv;
+	unsigned char qqic;
+	unsigned short nsrcs;
+};
+
+/* The IGMP part of a frame handed to harness_xmit */
+struct igmphdr *harness_frame_igmp(struct device *dev, struct sk_buff *skb, int *len);
+
+void harness_mc_map(unsigned long addr, unsigned char *mac);
+
+/* Group number n, counting up from 225.1.0.0 */
+static inline unsigned long harness_group(unsigned int n)
+{
+	return htonl(0xE1010000 + n);
+}
+
+uint64_t harness_ns(void);
+
+/* Threads other than main call this before touching the kernel code */
+void harness_thread_init(void);
+void harness_bh_enter(void);
+void harness_bh_exit(void);
+
+/* Exported by igmp.c and dev_mcast.c beyond what kern.h lists */
+extern int igmp_get_info(char *buffer, char **start, off_t offset, int length, int dummy);
+
+#endif
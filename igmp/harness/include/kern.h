@@ -0,0 +1,217 @@
+/*
+ *	The parts of the 1.x kernel that igmp.c and dev_mcast.c touch, cut
+ *	down to the fields and calls they use. The stub headers the kernel
+ *	files are built against pull this in, and so do the userspace
+ *	drivers, so it leans on neither side's system headers.
+ *
+ *	Wire headers use 32 bit fields where the kernel wrote unsigned long,
+ *	so they keep their size on an LP64 build. Everything else is as the
+ *	kernel declares it.
+ */
+
+#ifndef _HARNESS_KERN_H
+#define _HARNESS_KERN_H
+
+#define HZ			100
+
+#define GFP_BUFFER		0x00
+#define GFP_ATOMIC		0x01
+#define GFP_USER		0x02
+#define GFP_KERNEL		0x03
+
+#define FREE_READ		1
+#define FREE_WRITE		0
+
+#define MAX_ADDR_LEN		7
+#define ETH_ALEN		6
+#define ETH_HLEN		14
+#define ETH_P_IP		0x0800
+#define ARPHRD_ETHER		1
+
+#define IFF_UP			0x1
+#define IFF_BROADCAST		0x2
+#define IFF_LOOPBACK		0x8
+#define IFF_RUNNING		0x40
+#define IFF_PROMISC		0x100
+#define IFF_ALLMULTI		0x200
+#define IFF_MULTICAST		0x1000
+
+#ifndef IP_MAX_MEMBERSHIPS
+#define IP_MAX_MEMBERSHIPS	20
+#endif
+
+#define IGMP_HOST_MEMBERSHIP_QUERY	0x11
+#define IGMP_HOST_MEMBERSHIP_REPORT	0x12
+#define IGMP_HOST_LEAVE_MESSAGE		0x17
+#define IGMP_ALL_HOSTS		htonl(0xE0000001L)
+
+#define MCAST_EXCLUDE		0
+#define MCAST_INCLUDE		1
+
+struct sk_buff;
+struct sock;
+struct options;
+struct inet_protocol;
+
+struct timer_list
+{
+	struct timer_list *next;
+	struct timer_list *prev;
+	unsigned long expires;		/* Relative until add_timer */
+	unsigned long data;
+	void (*function)(unsigned long);
+};
+
+struct dev_mc_list
+{
+	struct dev_mc_list *next;
+	char dmi_addr[MAX_ADDR_LEN];
+	unsigned short dmi_addrlen;
+	unsigned short dmi_users;
+};
+
+struct ip_mc_list
+{
+	struct device *interface;
+	unsigned long multiaddr;
+	struct ip_mc_list *next;
+	struct timer_list timer;
+	int tm_running;
+	int users;
+};
+
+struct ip_mc_socklist
+{
+	unsigned long multiaddr[IP_MAX_MEMBERSHIPS];
+	struct device *multidev[IP_MAX_MEMBERSHIPS];
+};
+
+struct device
+{
+	char *name;
+	unsigned long pa_addr;
+	unsigned short flags;
+	unsigned short type;
+	unsigned long mtu;
+	unsigned short hard_header_len;
+	unsigned char addr_len;
+	unsigned char dev_addr[MAX_ADDR_LEN];
+	struct dev_mc_list *mc_list;
+	int mc_count;
+	struct ip_mc_list *ip_mc_list;
+	int (*hard_header)(unsigned char *buff, struct device *dev, unsigned short type,
+		void *daddr, void *saddr, unsigned len, struct sk_buff *skb);
+	void (*set_multicast_list)(struct device *dev, int num_addrs, void *addrs);
+	void *priv;
+};
+
+struct iphdr
+{
+	unsigned char ihl:4, version:4;
+	unsigned char tos;
+	unsigned short tot_len;
+	unsigned short id;
+	unsigned short frag_off;
+	unsigned char ttl;
+	unsigned char protocol;
+	unsigned short check;
+	unsigned int saddr;
+	unsigned int daddr;
+};
+
+struct igmphdr
+{
+	unsigned char type;
+	unsigned char unused;
+	unsigned short csum;
+	unsigned int group;
+};
+
+struct sk_buff
+{
+	struct sk_buff *next;
+	struct sk_buff *prev;
+	struct sock *sk;
+	struct device *dev;
+	union
+	{
+		unsigned char *raw;
+		struct igmphdr *igmph;
+	} h;
+	struct iphdr *ip_hdr;
+	unsigned long mem_len;
+	unsigned long len;
+	unsigned long saddr;
+	unsigned long daddr;
+	unsigned long raddr;
+	int arp;
+	unsigned char *data;
+};
+
+struct sk_buff_head
+{
+	struct sk_buff *next;
+	struct sk_buff *prev;
+	unsigned int qlen;
+};
+
+struct sock
+{
+	struct ip_mc_socklist *ip_mc_list;
+	int priority;
+};
+
+/* The kernel services the two files call */
+
+extern volatile unsigned long jiffies;
+extern unsigned long intr_count;
+
+extern void *kmalloc(unsigned int size, int priority);
+extern void kfree_s(void *obj, int size);
+extern int printk(const char *fmt, ...);
+
+extern void init_timer(struct timer_list *timer);
+extern void add_timer(struct timer_list *timer);
+extern int del_timer(struct timer_list *timer);
+
+extern struct sk_buff *alloc_skb(unsigned int size, int priority);
+extern void kfree_skb(struct sk_buff *skb, int rw);
+extern void skb_queue_head_init(struct sk_buff_head *list);
+extern void skb_queue_tail(struct sk_buff_head *list, struct sk_buff *skb);
+extern struct sk_buff *skb_dequeue(struct sk_buff_head *list);
+
+extern int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long daddr,
+	struct device **dev, int type, struct options *opt, int len, int tos, int ttl);
+extern void ip_queue_xmit(struct sock *sk, struct device *dev, struct sk_buff *skb, int free);
+extern unsigned short ip_compute_csum(unsigned char *buff, int len);
+
+/* Interrupt masking, see harness.c */
+
+extern unsigned long harness_save_flags(void);
+extern void harness_cli(void);
+extern void harness_restore_flags(unsigned long flags);
+
+/* What the two files export */
+
+extern void dev_mc_upload(struct device *dev);
+extern void dev_mc_add(struct device *dev, void *addr, int alen, int newonly);
+extern void dev_mc_delete(struct device *dev, void *addr, int alen, int all);
+extern void dev_mc_discard(struct device *dev);
+
+extern int igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+	struct inet_protocol *protocol);
+extern void ip_mc_allhost(struct device *dev);
+extern void ip_mc_drop_device(struct device *dev);
+extern int ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern int ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern void ip_mc_drop_socket(struct sock *sk);
+extern void ip_mc_filter_add(struct device *dev, unsigned long addr);
+extern void ip_mc_filter_del(struct device *dev, unsigned long addr);
+extern int ip_mc_source(struct sock *sk, struct device *dev, unsigned long addr,
+	unsigned long source, int add, int omode);
+extern int ip_mc_source_ok(struct device *dev, unsigned long addr, unsigned long saddr);
+extern int ip_mc_sf_allow(struct sock *sk, struct device *dev, unsigned long addr,
+	unsigned long saddr);
+
+#endif	/* _HARNESS_KERN_H */
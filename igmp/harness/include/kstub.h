@@ -0,0 +1,50 @@
+/*
+ *	Kernel side of the harness. Every stub header the kernel files
+ *	include comes here; they are built with -nostdinc so nothing of the
+ *	C library leaks in beyond the few string routines declared below.
+ */
+
+#ifndef _HARNESS_KSTUB_H
+#define _HARNESS_KSTUB_H
+
+#define CONFIG_IP_MULTICAST	1
+
+#define NULL			((void *)0)
+
+typedef unsigned long size_t;
+typedef long off_t;
+
+#define ENOENT			2
+#define ENOMEM			12
+#define EFAULT			14
+#define ENODEV			19
+#define EINVAL			22
+#define EADDRINUSE		98
+#define EADDRNOTAVAIL		99
+#define ENOBUFS			105
+
+#define IPPROTO_IGMP		2
+#define INADDR_ANY		((unsigned long)0x00000000)
+
+/* asm/byteorder.h, for a little endian host */
+#define ntohl(x)		((unsigned long)__builtin_bswap32((unsigned int)(x)))
+#define htonl(x)		ntohl(x)
+#define ntohs(x)		((unsigned short)__builtin_bswap16((unsigned short)(x)))
+#define htons(x)		ntohs(x)
+
+#define MULTICAST(x)		(((x) & htonl(0xf0000000)) == htonl(0xe0000000))
+
+#define save_flags(x)		((x)=harness_save_flags())
+#define restore_flags(x)	harness_restore_flags(x)
+#define cli()			harness_cli()
+
+#define kfree(x)		kfree_s((x), 0)
+
+extern void *memcpy(void *dest, const void *src, size_t n);
+extern void *memset(void *s, int c, size_t n);
+extern int memcmp(const void *s1, const void *s2, size_t n);
+extern int sprintf(char *buf, const char *fmt, ...);
+
+#include "kern.h"
+
+#endif	/* _HARNESS_KSTUB_H */
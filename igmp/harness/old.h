@@ -0,0 +1,59 @@
+/*
+ * Earlier versions of igmp.c and dev_mcast.c, frozen under versions/
+ * and built with every exported name prefixed by the version, so the
+ * benchmarks can run them beside the current code in one process:
+ *
+ *	old_		before the performance work
+ *	prearena_	the last version without the node arenas
+ *	precsum_	the last one calling ip_compute_csum on every message
+ *
+ * Each set keeps its own state; give each its own devices and sockets.
+ */
+#ifndef OLD_H
+#define OLD_H
+
+#include "harness.h"
+
+extern void old_dev_mc_upload(struct device *dev);
+extern void old_dev_mc_add(struct device *dev, void *addr, int alen, int newonly);
+extern void old_dev_mc_delete(struct device *dev, void *addr, int alen, int all);
+extern void old_dev_mc_discard(struct device *dev);
+
+extern int old_igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+	struct inet_protocol *protocol);
+extern void old_ip_mc_allhost(struct device *dev);
+extern void old_ip_mc_drop_device(struct device *dev);
+extern int old_ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern int old_ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern void old_ip_mc_drop_socket(struct sock *sk);
+
+extern void prearena_dev_mc_upload(struct device *dev);
+extern void prearena_dev_mc_add(struct device *dev, void *addr, int alen, int newonly);
+extern void prearena_dev_mc_delete(struct device *dev, void *addr, int alen, int all);
+extern void prearena_dev_mc_discard(struct device *dev);
+
+extern int prearena_igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+	struct inet_protocol *protocol);
+extern void prearena_ip_mc_allhost(struct device *dev);
+extern void prearena_ip_mc_drop_device(struct device *dev);
+extern int prearena_ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern int prearena_ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern void prearena_ip_mc_drop_socket(struct sock *sk);
+
+extern void precsum_dev_mc_upload(struct device *dev);
+extern void precsum_dev_mc_add(struct device *dev, void *addr, int alen, int newonly);
+extern void precsum_dev_mc_delete(struct device *dev, void *addr, int alen, int all);
+extern void precsum_dev_mc_discard(struct device *dev);
+
+extern int precsum_igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+	struct inet_protocol *protocol);
+extern void precsum_ip_mc_allhost(struct device *dev);
+extern void precsum_ip_mc_drop_device(struct device *dev);
+extern int precsum_ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern int precsum_ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr);
+extern void precsum_ip_mc_drop_socket(struct sock *sk);
+
+#endif
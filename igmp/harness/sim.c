@@ -0,0 +1,295 @@
+/*
+ * Query storm simulator. Every host is a harness device running igmp.c
+ * with a socket in the same groups, all on one segment with a querier.
+ * What a host sends is queued and heard by every other host once the
+ * jiffy's timers have run, so reports sent in the same tick do not
+ * suppress each other, as on a real wire.
+ *
+ *	sim [-n hosts] [-g groups] [-q queries] [-m tenths] [-i seconds]
+ *
+ * Without -n it runs 10, 100 and 1000 hosts. Queries are v2 with a
+ * maximum response of -m tenths of a second, 0 sends v1 queries; they
+ * are -i seconds apart. For each run it prints, per query:
+ *
+ *	reports		reports sent, against one per group at best
+ *	extra		the share of them that were not the first for the group
+ *	indep		what extra would be if every host drew its delays
+ *			independently and evenly, as igmp.c should
+ *	supp		answers suppressed by another host's report
+ *	dup		igmp.c's count of reports a sender heard within HZ/10
+ *			of its own, per report sent
+ *	cpu		time spent in igmp.c and on the segment, all hosts
+ *	learned		until the querier had heard every group
+ *	quiet		until the last report
+ *
+ * and the delays the hosts chose, in tenths of the allowed window.
+ *
+ * All the hosts share one igmp.c, which finds a device's state on a
+ * list, once per report heard. The cpu column therefore grows with the
+ * square of the host count here, where on each real host it would not.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include "harness.h"
+
+#define DELAY_BUCKETS	10		/* As IGMP_DELAY_BUCKETS in igmp.c */
+
+/* A message on the wire, not yet heard */
+struct msg
+{
+	struct device *from;
+	unsigned long daddr;
+	unsigned long saddr;
+	int len;
+	unsigned char *igmp;
+};
+
+static struct msg *wire;
+static int nwire, wire_max;
+
+static struct device **host;
+static struct sock **sk;
+static int nhosts, ngroups;
+
+static void sent(struct device *dev, struct sk_buff *skb)
+{
+	struct igmphdr *igh;
+	struct msg *m;
+	int len;
+
+	if (nwire == wire_max)
+	{
+		wire_max = wire_max ? 2 * wire_max : 1024;
+		wire = realloc(wire, wire_max * sizeof(*wire));
+	}
+	igh = harness_frame_igmp(dev, skb, &len);
+	m = &wire[nwire++];
+	m->from = dev;
+	m->daddr = skb->ip_hdr->daddr;
+	m->saddr = skb->ip_hdr->saddr;
+	m->len = len;
+	m->igmp = malloc(len);
+	memcpy(m->igmp, igh, len);
+}
+
+static void hear(struct device *dev, unsigned long daddr, unsigned long saddr, void *igmp, int len)
+{
+	struct sk_buff *skb = harness_igmp_skb(dev, daddr, saddr, igmp, len, 1);
+
+	harness_bh_enter();
+	igmp_rcv(skb, dev, NULL, daddr, len, saddr, 0, NULL);
+	harness_bh_exit();
+}
+
+/* Forget what is on the wire, as while the hosts come up */
+static void flush(void)
+{
+	while (nwire)
+		free(wire[--nwire].igmp);
+}
+
+/*
+ * Everything sent so far reaches every other host, marking the groups
+ * reported.
+ */
+static void deliver(unsigned char *reported)
+{
+	struct igmphdr *igh;
+	int i, h;
+
+	for (i = 0; i < nwire; i++)
+	{
+		igh = (struct igmphdr *)wire[i].igmp;
+		if (igh->type != IGMP_HOST_MEMBERSHIP_QUERY && igh->type != IGMP_HOST_LEAVE_MESSAGE)
+			reported[ntohl(igh->group) - ntohl(harness_group(0))] = 1;
+		for (h = 0; h < nhosts; h++)
+			if (host[h] != wire[i].from)
+				hear(host[h], wire[i].daddr, wire[i].saddr, wire[i].igmp, wire[i].len);
+		free(wire[i].igmp);
+	}
+	nwire = 0;
+}
+
+/* The counters and delay histogram from /proc/net/igmp */
+static void counters(unsigned long *c, unsigned long *delays)
+{
+	char buf[512], *start, *p;
+	int i;
+
+	igmp_get_info(buf, &start, 0, sizeof(buf), 0);
+	p = strchr(buf, '\n');
+	if (sscanf(p, "%lu %lu %lu %lu", &c[0], &c[1], &c[2], &c[3]) != 4)
+		memset(c, 0, 4 * sizeof(*c));
+	p = strstr(p, "Delays") + 6;
+	for (i = 0; i < DELAY_BUCKETS; i++)
+		delays[i] = strtoul(p, &p, 10);
+}
+
+/*
+ * Reports expected per group from independent delays over a window of
+ * max jiffies. igmp_start_timer draws 0 to max-1 and runs a 0 as 1, and
+ * every host whose delay is the least answers in the same tick. A host
+ * answers when all the others drew no less than it did.
+ */
+static double expected(int max)
+{
+	double e = 0;
+	int k;
+
+	for (k = 1; k < max; k++)
+		e += (k == 1 ? 2.0 : 1.0) / max * pow((double)(k == 1 ? max : max - k) / max, nhosts - 1);
+	return max > 1 ? nhosts * e : nhosts;
+}
+
+static void run(int queries, int tenths, int interval)
+{
+	unsigned long c0[4], c1[4], d0[DELAY_BUCKETS], d1[DELAY_BUCKETS], chosen;
+	unsigned char *reported = calloc(ngroups, 1);
+	unsigned long learned = 0, quiet = 0;
+	double e;
+	uint64_t ns = 0, t0;
+	struct igmphdr igh;
+	int h, g, q, t, left, last;
+
+	host = calloc(nhosts, sizeof(*host));
+	sk = calloc(nhosts, sizeof(*sk));
+	for (h = 0; h < nhosts; h++)
+	{
+		char name[16];
+
+		snprintf(name, sizeof(name), "h%d", h);
+		host[h] = harness_dev(name, htonl(0x0A000002 + h), 1);
+		sk[h] = harness_sock();
+		ip_mc_allhost(host[h]);
+		for (g = 0; g < ngroups; g++)
+			ip_mc_join_group(sk[h], host[h], harness_group(g));
+	}
+	/* The joins' own reports go out unheard */
+	while (harness_timers_pending())
+		harness_tick(1);
+	flush();
+
+	counters(c0, d0);
+	harness_igmphdr(&igh, IGMP_HOST_MEMBERSHIP_QUERY, tenths, 0);
+	for (q = 0; q < queries; q++)
+	{
+		memset(reported, 0, ngroups);
+		left = ngroups;
+		t0 = harness_ns();
+		for (h = 0; h < nhosts; h++)
+			hear(host[h], IGMP_ALL_HOSTS, htonl(0x0A000001), &igh, sizeof(igh));
+		ns += harness_ns() - t0;
+		last = 0;
+		for (t = 1; t <= interval * HZ; t++)
+		{
+			t0 = harness_ns();
+			harness_tick(1);
+			if (nwire)
+			{
+				last = t;
+				deliver(reported);
+				for (g = 0; g < ngroups; g++)
+					if (reported[g] == 1)
+					{
+						reported[g] = 2;
+						if (--left == 0)
+							learned += t;
+					}
+			}
+			ns += harness_ns() - t0;
+		}
+		quiet += last;
+	}
+	counters(c1, d1);
+
+	for (chosen = 0, h = 0; h < DELAY_BUCKETS; h++)
+		chosen += d1[h] - d0[h];
+	e = expected(tenths ? tenths * HZ / 10 : 10 * HZ);
+	printf("%6d %6d %8.1f %6d %6.1f%% %6.1f%% %6.1f%% %6.1f%% %9.1f %9.0f %9.0f\n", nhosts, ngroups,
+		(double)(c1[1] - c0[1]) / queries, ngroups,
+		100.0 * ((c1[1] - c0[1]) - (double)ngroups * queries) / ((c1[1] - c0[1]) ? : 1),
+		100.0 * (e - 1) / e,
+		100.0 * (c1[2] - c0[2]) / ((c1[1] - c0[1]) + (c1[2] - c0[2]) ? : 1),
+		100.0 * (c1[3] - c0[3]) / ((c1[1] - c0[1]) ? : 1),
+		ns / 1e3 / queries, 1000.0 * learned / HZ / queries, 1000.0 * quiet / HZ / queries);
+	printf("delays");
+	for (h = 0; h < DELAY_BUCKETS; h++)
+		printf(" %4.1f%%", chosen ? 100.0 * (d1[h] - d0[h]) / chosen : 0);
+	printf("\n");
+	fflush(stdout);
+
+	for (h = 0; h < nhosts; h++)
+	{
+		ip_mc_drop_socket(sk[h]);
+		harness_sock_free(sk[h]);
+		ip_mc_drop_device(host[h]);
+		dev_mc_discard(host[h]);
+	}
+	while (harness_timers_pending())
+		harness_tick(1);
+	flush();
+	free(host);
+	free(sk);
+	free(reported);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: sim [-n hosts] [-g groups] [-q queries] [-m tenths] [-i seconds]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sweep[] = { 10, 100, 1000 };
+	int queries = 4, tenths = 100, interval = 0, hosts = 0;
+	unsigned int i;
+	int c;
+
+	ngroups = 10;
+	while ((c = getopt(argc, argv, "n:g:q:m:i:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				hosts = atoi(optarg);
+				break;
+			case 'g':
+				ngroups = atoi(optarg);
+				break;
+			case 'q':
+				queries = atoi(optarg);
+				break;
+			case 'm':
+				tenths = atoi(optarg);
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			default:
+				usage();
+		}
+	}
+	if (optind != argc || ngroups < 1 || queries < 1 || tenths < 0 || tenths > 255)
+		usage();
+	/* Long enough for every delay to run out */
+	if (interval == 0)
+		interval = (tenths ? tenths : 100) / 10 + 1;
+	harness_quiet = 1;
+	harness_xmit = sent;
+	printf("%s queries, %d.%d s to answer, %d s apart\n", tenths ? "v2" : "v1",
+		(tenths ? tenths : 100) / 10, (tenths ? tenths : 100) % 10, interval);
+	printf("%6s %6s %8s %6s %7s %7s %7s %7s %9s %9s %9s\n", "hosts", "groups", "reports",
+		"best", "extra", "indep", "supp", "dup", "cpu us", "learned", "quiet");
+	for (i = 0; i < sizeof(sweep) / sizeof(sweep[0]); i++)
+	{
+		nhosts = hosts ? hosts : sweep[i];
+		run(queries, tenths, interval);
+		if (hosts)
+			break;
+	}
+	return 0;
+}
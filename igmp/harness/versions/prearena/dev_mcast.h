@@ -0,0 +1,31 @@
+/*
+ *	Linux NET3:	Multicast List maintenance.
+ *
+ *	Calls into dev_mcast.c beyond the basic list operations declared
+ *	with struct device.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _DEV_MCAST_H
+#define _DEV_MCAST_H
+
+/*
+ *	Passed to set_multicast_list as the address count when the device
+ *	should take every multicast frame. Drivers that only know about -1
+ *	will treat it as promiscuous, which is what they got before.
+ */
+ 
+#define DEV_MC_ALLMULTI		(-2)
+
+extern int dev_mc_batch_begin(struct device *dev);
+extern void dev_mc_batch_end(struct device *dev);
+extern int dev_mc_set_delay(struct device *dev, int delay);
+extern int dev_mc_set_limit(struct device *dev, int limit);
+extern int dev_mc_hash_filter(struct device *dev, int bits, unsigned char *filter);
+extern int dev_mc_get_info(char *buffer, char **start, off_t offset, int length, int dummy);
+
+#endif	/* _DEV_MCAST_H */
@@ -0,0 +1,823 @@
+/*
+ *	Linux NET3:	Multicast List maintenance. 
+ *
+ *	Authors:
+ *		Tim Kordas <tjk@nostromo.eeap.cwru.edu> 
+ *		Richard Underwood <richard@wuzz.demon.co.uk>
+ *
+ *	Stir fried together from the IP multicast and CAP patches above
+ *		Alan Cox <Alan.Cox@linux.org>	
+ *
+ *	Fixes:
+ *		Alan Cox	:	Update the device on a real delete
+ *					rather than any time but...
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+ 
+#include <asm/segment.h>
+#include <asm/system.h>
+#include <asm/bitops.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/in.h>
+#include <linux/errno.h>
+#include <linux/interrupt.h>
+#include <linux/if_ether.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include "ip.h"
+#include "route.h"
+#include <linux/skbuff.h>
+#include "sock.h"
+#include "arp.h"
+#include "dev_mcast.h"
+
+
+/*
+ *	Device multicast list maintenance. This knows about such little matters as promiscuous mode and
+ *	converting from the list to the array the drivers use. At least until I fix the drivers up.
+ *
+ *	This is used both by IP and by the user level maintenance functions. Unlike BSD we maintain a usage count
+ *	on a given multicast address so that a casual user application can add/delete multicasts used by protocols
+ *	without doing damage to the protocols when it deletes the entries. It also helps IP as it tracks overlapping
+ *	maps.
+ */
+ 
+
+/*
+ *	Address index. Each dev_mc_list entry is the front of a dev_mc_node
+ *	which also chains it into a hash on (device, address) and remembers
+ *	the link pointing at it in dev->mc_list, so add and delete don't
+ *	compare against every address on the device. The bucket array starts
+ *	small and doubles with the number of entries.
+ */
+
+struct dev_mc_node
+{
+	struct dev_mc_list dmi;		/* Must be first */
+	struct dev_mc_node *hash_next;
+	struct dev_mc_list **pprev;	/* Link that points at us */
+	struct device *dev;
+	int slot;			/* Index in the packed upload array */
+};
+
+#define DEV_MC_NODE(dmi)	((struct dev_mc_node *)(dmi))
+
+#define DEV_MC_HASH_MIN		64
+#define DEV_MC_HASH_MAX		16384	/* Keep the buckets in one kmalloc */
+
+static struct dev_mc_node *dev_mc_hash_min[DEV_MC_HASH_MIN];
+static struct dev_mc_node **dev_mc_hash=dev_mc_hash_min;
+static unsigned int dev_mc_hash_size=DEV_MC_HASH_MIN;
+static unsigned int dev_mc_hash_count=0;
+
+static inline unsigned int dev_mc_hashfn(struct device *dev, void *addr, int alen, unsigned int size)
+{
+	unsigned char *p=(unsigned char *)addr;
+	unsigned long h=(unsigned long)dev>>4;
+	while(alen--)
+		h=(h<<5)+h+*p++;
+	h^=h>>16;
+	return h&(size-1);
+}
+
+static struct dev_mc_list *dev_mc_find(struct device *dev, void *addr, int alen)
+{
+	struct dev_mc_node *n=dev_mc_hash[dev_mc_hashfn(dev,addr,alen,dev_mc_hash_size)];
+	for(;n!=NULL;n=n->hash_next)
+		if(n->dev==dev && n->dmi.dmi_addrlen==alen && memcmp(n->dmi.dmi_addr,addr,alen)==0)
+			return &n->dmi;
+	return NULL;
+}
+
+/*
+ *	Double the bucket array. If the memory isn't there we just carry
+ *	on with longer chains.
+ */
+ 
+static void dev_mc_hash_grow(void)
+{
+	struct dev_mc_node **nh, *n, *next;
+	unsigned int size=dev_mc_hash_size*2;
+	unsigned int i, h;
+	
+	nh=(struct dev_mc_node **)kmalloc(size*sizeof(*nh), GFP_KERNEL);
+	if(nh==NULL)
+		return;
+	memset(nh,0,size*sizeof(*nh));
+	for(i=0;i<dev_mc_hash_size;i++)
+	{
+		for(n=dev_mc_hash[i];n!=NULL;n=next)
+		{
+			next=n->hash_next;
+			h=dev_mc_hashfn(n->dev,n->dmi.dmi_addr,n->dmi.dmi_addrlen,size);
+			n->hash_next=nh[h];
+			nh[h]=n;
+		}
+	}
+	if(dev_mc_hash!=dev_mc_hash_min)
+		kfree_s(dev_mc_hash,dev_mc_hash_size*sizeof(*dev_mc_hash));
+	dev_mc_hash=nh;
+	dev_mc_hash_size=size;
+}
+
+static void dev_mc_link(struct device *dev, struct dev_mc_list *dmi)
+{
+	struct dev_mc_node *n=DEV_MC_NODE(dmi);
+	unsigned int h;
+	
+	n->dev=dev;
+	dmi->next=dev->mc_list;
+	if(dmi->next!=NULL)
+		DEV_MC_NODE(dmi->next)->pprev=&dmi->next;
+	n->pprev=&dev->mc_list;
+	dev->mc_list=dmi;
+	h=dev_mc_hashfn(dev,dmi->dmi_addr,dmi->dmi_addrlen,dev_mc_hash_size);
+	n->hash_next=dev_mc_hash[h];
+	dev_mc_hash[h]=n;
+	dev_mc_hash_count++;
+}
+
+static void dev_mc_unlink(struct dev_mc_list *dmi)
+{
+	struct dev_mc_node *n=DEV_MC_NODE(dmi);
+	struct dev_mc_node **np;
+	
+	*n->pprev=dmi->next;
+	if(dmi->next!=NULL)
+		DEV_MC_NODE(dmi->next)->pprev=n->pprev;
+	np=&dev_mc_hash[dev_mc_hashfn(n->dev,dmi->dmi_addr,dmi->dmi_addrlen,dev_mc_hash_size)];
+	for(;*np!=NULL;np=&(*np)->hash_next)
+	{
+		if(*np==n)
+		{
+			*np=n->hash_next;
+			break;
+		}
+	}
+	dev_mc_hash_count--;
+}
+
+/*
+ *	Node arenas. Blocks a little under a page are cut into objects
+ *	aligned to a (486) cache line. Freed objects go on a free list and
+ *	the blocks are only handed back when the arena empties or is
+ *	released as a whole.
+ */
+
+#define MC_ARENA_ALIGN		16
+#define MC_ARENA_CHUNK		4000	/* Fits a page with kmalloc's header */
+
+void mc_arena_init(struct mc_arena *a, int size)
+{
+	a->chunks=NULL;
+	a->free=NULL;
+	a->size=(size+MC_ARENA_ALIGN-1)&~(MC_ARENA_ALIGN-1);
+	a->inuse=0;
+	a->nchunks=0;
+}
+
+static int mc_arena_grow(struct mc_arena *a, int priority)
+{
+	void **chunk=(void **)kmalloc(MC_ARENA_CHUNK, priority);
+	unsigned long p, end;
+	
+	if(chunk==NULL)
+		return -ENOMEM;
+	*chunk=a->chunks;
+	a->chunks=chunk;
+	a->nchunks++;
+	p=((unsigned long)(chunk+1)+MC_ARENA_ALIGN-1)&~(MC_ARENA_ALIGN-1);
+	end=(unsigned long)chunk+MC_ARENA_CHUNK;
+	for(;p+a->size<=end;p+=a->size)
+	{
+		*(void **)p=a->free;
+		a->free=(void *)p;
+	}
+	return 0;
+}
+
+void *mc_arena_alloc(struct mc_arena *a, int priority)
+{
+	void **obj;
+	
+	if(a->free==NULL && mc_arena_grow(a,priority)<0)
+		return NULL;
+	obj=(void **)a->free;
+	a->free=*obj;
+	a->inuse++;
+	return obj;
+}
+
+void mc_arena_release(struct mc_arena *a)
+{
+	void **chunk;
+	
+	while(a->chunks!=NULL)
+	{
+		chunk=(void **)a->chunks;
+		a->chunks=*chunk;
+		kfree_s(chunk,MC_ARENA_CHUNK);
+	}
+	a->free=NULL;
+	a->inuse=0;
+	a->nchunks=0;
+}
+
+void mc_arena_free(struct mc_arena *a, void *obj)
+{
+	*(void **)obj=a->free;
+	a->free=obj;
+	if(--a->inuse==0)
+		mc_arena_release(a);
+}
+
+/*
+ *	Per device upload state. List changes can be held back, either
+ *	between dev_mc_batch_begin and dev_mc_batch_end or for a short
+ *	per device delay, so that a burst of joins reprograms the NIC once
+ *	rather than once per address. Devices that ask for neither upload
+ *	on every change as before.
+ *
+ *	The state also keeps the addresses packed in the layout the drivers
+ *	want. Adds append, deletes move the last address into the hole, so
+ *	an upload hands over the array as it stands.
+ *
+ *	Alongside the list we keep a 512 bucket hash of the addresses, using
+ *	the top bits of the Ethernet CRC as most hash filter chips do. A
+ *	driver folds it down to the size of its filter with
+ *	dev_mc_hash_filter instead of hashing the list itself. Past the per
+ *	device limit we stop sending the list and ask for all multicast.
+ *
+ *	The list entries themselves come from the state's node arena.
+ */
+
+#define DEV_MC_HASH_BITS	512
+
+struct dev_mc_state
+{
+	struct dev_mc_state *next;
+	struct device *dev;
+	int batch;			/* Nesting depth of explicit batches */
+	int delay;			/* Jiffies to hold changes, 0 for none */
+	int pending;			/* NIC filter is out of date */
+	unsigned long uploads;		/* Calls to set_multicast_list */
+	unsigned long coalesced;	/* Changes folded into a later upload */
+	char *addrs;			/* Packed addresses, addr_len apart */
+	struct dev_mc_node **owner;	/* Entry stored in each slot */
+	int count;			/* Slots in use */
+	int size;			/* Slots allocated */
+	int packed;			/* addrs matches dev->mc_list */
+	int limit;			/* Most addresses to upload, 0 for no limit */
+	int allmulti;			/* Last upload asked for all multicast */
+	unsigned short hash_count[DEV_MC_HASH_BITS];
+	unsigned char hash_filter[DEV_MC_HASH_BITS/8];
+	struct mc_arena nodes;		/* Where our dev_mc_nodes live */
+};
+
+#define DEV_MC_PACK_MIN		16
+
+static struct dev_mc_state *dev_mc_states=NULL;
+static struct timer_list dev_mc_timer;
+static int dev_mc_timer_running=0;
+
+/*
+ *	Ethernet CRC, most significant bit first. The top 9 bits pick the
+ *	hash bucket.
+ */
+ 
+static unsigned long dev_mc_crc(unsigned char *addr, int alen)
+{
+	unsigned long crc=0xFFFFFFFF;
+	int bit;
+	
+	while(alen--)
+	{
+		unsigned char c=*addr++;
+		for(bit=0;bit<8;bit++,c>>=1)
+		{
+			if(((crc>>31)^c)&1)
+				crc=(crc<<1)^0x04C11DB7;
+			else
+				crc<<=1;
+			crc&=0xFFFFFFFF;
+		}
+	}
+	return crc;
+}
+
+static void dev_mc_hash_add(struct dev_mc_state *st, struct dev_mc_list *dmi)
+{
+	int h=dev_mc_crc((unsigned char *)dmi->dmi_addr,dmi->dmi_addrlen)>>23;
+	if(st->hash_count[h]++==0)
+		st->hash_filter[h>>3]|=1<<(h&7);
+}
+
+static void dev_mc_hash_del(struct dev_mc_state *st, struct dev_mc_list *dmi)
+{
+	int h=dev_mc_crc((unsigned char *)dmi->dmi_addr,dmi->dmi_addrlen)>>23;
+	if(--st->hash_count[h]==0)
+		st->hash_filter[h>>3]&=~(1<<(h&7));
+}
+
+static struct dev_mc_state *dev_mc_state_find(struct device *dev)
+{
+	struct dev_mc_state *st;
+	for(st=dev_mc_states;st!=NULL;st=st->next)
+		if(st->dev==dev)
+			return st;
+	return NULL;
+}
+
+static struct dev_mc_state *dev_mc_state_get(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	struct dev_mc_list *dmi;
+	if(st!=NULL)
+		return st;
+	st=(struct dev_mc_state *)kmalloc(sizeof(*st), GFP_KERNEL);
+	if(st==NULL)
+		return NULL;
+	memset(st,0,sizeof(*st));
+	st->dev=dev;
+	st->packed=(dev->mc_count==0);	/* Else the first upload packs it */
+	mc_arena_init(&st->nodes,sizeof(struct dev_mc_node));
+	for(dmi=dev->mc_list;dmi!=NULL;dmi=dmi->next)
+		dev_mc_hash_add(st,dmi);
+	st->next=dev_mc_states;
+	dev_mc_states=st;
+	return st;
+}
+
+static void dev_mc_pack_free(struct dev_mc_state *st)
+{
+	if(st->size)
+	{
+		kfree_s(st->addrs,st->size*st->dev->addr_len);
+		kfree_s(st->owner,st->size*sizeof(*st->owner));
+	}
+	st->addrs=NULL;
+	st->owner=NULL;
+	st->count=0;
+	st->size=0;
+}
+
+static int dev_mc_pack_resize(struct dev_mc_state *st, int size, int priority)
+{
+	int alen=st->dev->addr_len;
+	char *addrs;
+	struct dev_mc_node **owner;
+	
+	addrs=kmalloc(size*alen, priority);
+	if(addrs==NULL)
+		return -ENOMEM;
+	owner=(struct dev_mc_node **)kmalloc(size*sizeof(*owner), priority);
+	if(owner==NULL)
+	{
+		kfree_s(addrs,size*alen);
+		return -ENOMEM;
+	}
+	if(st->count)
+	{
+		memcpy(addrs,st->addrs,st->count*alen);
+		memcpy(owner,st->owner,st->count*sizeof(*owner));
+	}
+	if(st->size)
+	{
+		kfree_s(st->addrs,st->size*alen);
+		kfree_s(st->owner,st->size*sizeof(*st->owner));
+	}
+	st->addrs=addrs;
+	st->owner=owner;
+	st->size=size;
+	return 0;
+}
+
+/*
+ *	Give a new entry the next free slot. If the array can't grow we
+ *	drop it and let the next upload rebuild it from the list.
+ */
+ 
+static void dev_mc_pack_add(struct dev_mc_state *st, struct dev_mc_node *n)
+{
+	if(!st->packed)
+		return;
+	if(st->count==st->size && dev_mc_pack_resize(st, st->size ? st->size*2 : DEV_MC_PACK_MIN, GFP_KERNEL)<0)
+	{
+		dev_mc_pack_free(st);
+		st->packed=0;
+		return;
+	}
+	n->slot=st->count++;
+	st->owner[n->slot]=n;
+	memcpy(st->addrs+n->slot*st->dev->addr_len,n->dmi.dmi_addr,n->dmi.dmi_addrlen);
+}
+
+static void dev_mc_pack_del(struct dev_mc_state *st, struct dev_mc_node *n)
+{
+	int alen=st->dev->addr_len;
+	struct dev_mc_node *last;
+	
+	if(!st->packed)
+		return;
+	last=st->owner[--st->count];
+	if(last!=n)
+	{
+		memcpy(st->addrs+n->slot*alen,st->addrs+last->slot*alen,alen);
+		last->slot=n->slot;
+		st->owner[n->slot]=last;
+	}
+}
+
+/*
+ *	Pack the whole list again after an allocation failure.
+ */
+ 
+static int dev_mc_pack_rebuild(struct dev_mc_state *st, int priority)
+{
+	struct dev_mc_list *dmi;
+	int size=DEV_MC_PACK_MIN;
+	
+	while(size<st->dev->mc_count)
+		size*=2;
+	dev_mc_pack_free(st);
+	if(dev_mc_pack_resize(st,size,priority)<0)
+		return -ENOMEM;
+	for(dmi=st->dev->mc_list;dmi!=NULL;dmi=dmi->next)
+	{
+		struct dev_mc_node *n=DEV_MC_NODE(dmi);
+		n->slot=st->count++;
+		st->owner[n->slot]=n;
+		memcpy(st->addrs+n->slot*st->dev->addr_len,dmi->dmi_addr,dmi->dmi_addrlen);
+	}
+	st->packed=1;
+	return 0;
+}
+
+/*
+ *	Update the multicast list into the physical NIC controller.
+ */
+ 
+void dev_mc_upload(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+
+	/* Whatever happens below, nothing held back is still owed */
+	if(st!=NULL)
+		st->pending=0;
+
+	/* Don't do anything till we up the interface
+	   [dev_open will call this function so the list will
+	    stay sane] */
+	    
+	if(!(dev->flags&IFF_UP))
+		return;
+		
+		
+	/* Devices with no set multicast don't get set */
+	/*
+	 *如果驱动程序没有提供相应的多播地址设置函数，则简单返回，因为这个新的多播地址设置
+	 生效必须由驱动程序配合才能实现，如果驱动程序没有提供这个功能，那么从底层上就不支
+	 持多播地址的变动性。
+	 * */
+	if(dev->set_multicast_list==NULL)
+		return;
+	if(st!=NULL)
+		st->uploads++;
+	/* Promiscuous is promiscuous - so no filter needed 
+	 *对于混杂模式，网络设备接受所有的数据包，无需进行数据包过滤设置。
+	 * */
+	if(dev->flags&IFF_PROMISC)
+	{
+		dev->set_multicast_list(dev, -1, NULL);
+		return;
+	}
+	
+	/* Too many to list - take them all and let IP sort it out */
+	if(st!=NULL)
+		st->allmulti=((dev->flags&IFF_ALLMULTI) || (st->limit && dev->mc_count>st->limit));
+	if((dev->flags&IFF_ALLMULTI) || (st!=NULL && st->allmulti))
+	{
+		dev->set_multicast_list(dev, DEV_MC_ALLMULTI, NULL);
+		return;
+	}
+	
+	/*
+	 device结构中set_multicast_list指针指向的函数第二个参数表示多播地址个数，第三个参
+	 数表示具体的多播地址，这些地址紧密排列，set_multicast_list指向的函数将根据第二个
+	 参数指定的多播地址的个数，依次对第三个参数指向的地址列表进行处理。如果第二个参数
+	 为0，则表示当前不使用多播，换句话说，网络设备将被设置成为丢弃所有多播数据包（根
+	 本不对多播数据包进行接收）
+	 * */
+	if(dev->mc_count==0)
+	{
+		dev->set_multicast_list(dev,0,NULL);
+		return;
+	}
+	
+	/* A delayed upload runs from the timer */
+	if(st==NULL || (!st->packed && dev_mc_pack_rebuild(st, intr_count ? GFP_ATOMIC : GFP_KERNEL)<0))
+	{
+		printk("Unable to get memory to set multicast list on %s\n",dev->name);
+		return;
+	}
+	/*成对新的多播列表的处理，代码实现很简单，因为复杂的工作都被屏蔽在由
+	 * set_multicast_list指向的函数中了，如上文所述，这个函数将有网络设备驱动程序提供。
+	 * 实现的工作是根据具体硬件对多播地址的设置方式，对每个MAC多播地址进行硬件指定的计
+	 * 算（一般计算得到一个比特位用于设置硬件寄存器中对应比特位），并配置多播相关寄存器，
+	 * 完成对新的设置的响应，这个过程中需要暂时停止网络设备的工作，在配置完成后，重新启
+	 * 动，从而使新的设置生效。具体的情况网络接收设备相关
+	 * */
+	dev->set_multicast_list(dev,dev->mc_count,st->addrs);
+}
+  
+/*
+ *	The list has changed. Upload now unless the device is holding
+ *	changes back.
+ */
+ 
+static void dev_mc_changed(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	
+	if(st==NULL || (st->batch==0 && st->delay==0))
+	{
+		dev_mc_upload(dev);
+		return;
+	}
+	if(st->pending)
+		st->coalesced++;
+	st->pending=1;
+	if(st->batch==0 && !dev_mc_timer_running)
+	{
+		dev_mc_timer.expires=st->delay;
+		dev_mc_timer_running=1;
+		add_timer(&dev_mc_timer);
+	}
+}
+
+/*
+ *	The hold-back window is over. Push every device that is not inside
+ *	an explicit batch.
+ */
+ 
+static void dev_mc_timer_expire(unsigned long data)
+{
+	struct dev_mc_state *st;
+	dev_mc_timer_running=0;
+	for(st=dev_mc_states;st!=NULL;st=st->next)
+		if(st->pending && st->batch==0)
+			dev_mc_upload(st->dev);
+}
+
+/*
+ *	Hold back uploads until the matching dev_mc_batch_end. Batches
+ *	nest.
+ */
+ 
+int dev_mc_batch_begin(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->batch++;
+	return 0;
+}
+
+void dev_mc_batch_end(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	if(st==NULL || st->batch==0)
+		return;
+	if(--st->batch==0 && st->pending)
+		dev_mc_upload(dev);
+}
+
+/*
+ *	Set how many jiffies list changes may be held back on a device.
+ *	Zero goes back to uploading on every change.
+ */
+ 
+int dev_mc_set_delay(struct device *dev, int delay)
+{
+	struct dev_mc_state *st;
+	
+	if(delay<0)
+		return -EINVAL;
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	if(!dev_mc_timer_running)
+	{
+		init_timer(&dev_mc_timer);
+		dev_mc_timer.function=&dev_mc_timer_expire;
+	}
+	st->delay=delay;
+	if(delay==0 && st->pending && st->batch==0)
+		dev_mc_upload(dev);
+	return 0;
+}
+
+/*
+ *	Cap the number of addresses uploaded to a device. Past it the device
+ *	is asked for all multicast. Zero removes the cap.
+ */
+ 
+int dev_mc_set_limit(struct device *dev, int limit)
+{
+	struct dev_mc_state *st;
+	
+	if(limit<0)
+		return -EINVAL;
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return -ENOMEM;
+	st->limit=limit;
+	dev_mc_changed(dev);
+	return 0;
+}
+
+/*
+ *	For drivers: fill in a hash filter of 64, 128 or 512 bits for the
+ *	current list. Bit n of the filter is bit n&7 of byte n>>3, and n is
+ *	the top 6, 7 or 9 bits of the Ethernet CRC of the address.
+ */
+ 
+int dev_mc_hash_filter(struct device *dev, int bits, unsigned char *filter)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	int shift, i;
+	
+	switch(bits)
+	{
+		case 64:
+			shift=3;
+			break;
+		case 128:
+			shift=2;
+			break;
+		case 512:
+			shift=0;
+			break;
+		default:
+			return -EINVAL;
+	}
+	memset(filter,0,bits/8);
+	if(st==NULL)
+		return 0;
+	if(shift==0)
+	{
+		memcpy(filter,st->hash_filter,sizeof(st->hash_filter));
+		return 0;
+	}
+	for(i=0;i<DEV_MC_HASH_BITS;i++)
+	{
+		if(st->hash_count[i])
+		{
+			int h=i>>shift;
+			filter[h>>3]|=1<<(h&7);
+		}
+	}
+	return 0;
+}
+
+/*
+ *	Delete a device level multicast
+ */
+ 
+void dev_mc_delete(struct device *dev, void *addr, int alen, int all)
+{
+	struct dev_mc_list *dmi=dev_mc_find(dev,addr,alen);
+	struct dev_mc_state *st;
+	if(dmi==NULL)
+		return;
+	if(--dmi->dmi_users && !all)
+		return;
+	dev_mc_unlink(dmi);
+	st=dev_mc_state_find(dev);	/* Always there, it owns dmi */
+	dev_mc_pack_del(st,DEV_MC_NODE(dmi));
+	dev_mc_hash_del(st,dmi);
+	dev->mc_count--;
+	mc_arena_free(&st->nodes,DEV_MC_NODE(dmi));
+	dev_mc_changed(dev);
+}
+
+/*
+ *	Add a device level multicast
+ */
+ 
+/*
+ *参数dev表示对应的网络设备，addr表示MAC多播地址，alen表示MAC地址长度，newonly参数
+ 在调用时被简单设置为0，该参数表示的意义根据下文代码实现的意义来看，表示如果存在
+ 相同地址，是否增加已有地址的使用计数，还是不进行任何操作，换句话说，newonly表示
+ 只有加入的多播地址是一个全新的地址时，才进行响应的操作。由于dev_mc_add函数被调用
+ 的目的就是对新加入的多播地址进行设备层的添加，所以下面的代码主要就是操作device
+ 结构中mc_list字段指向多播MAC地址链表，诚如前文中对IGMP协议的说明，设备维护多播MAC
+ 地址列表中每个元素都是一个dev_mc_list结构
+ *
+ * */
+void dev_mc_add(struct device *dev, void *addr, int alen, int newonly)
+{
+	struct dev_mc_list *dmi=dev_mc_find(dev,addr,alen);
+	struct dev_mc_state *st;
+	if(dmi!=NULL)
+	{
+		if(!newonly)
+			dmi->dmi_users++;
+		return;
+	}
+	st=dev_mc_state_get(dev);
+	if(st==NULL)
+		return;
+	if(dev_mc_hash_count>=dev_mc_hash_size && dev_mc_hash_size<DEV_MC_HASH_MAX)
+		dev_mc_hash_grow();
+	dmi=(struct dev_mc_list *)mc_arena_alloc(&st->nodes,GFP_KERNEL);
+	if(dmi==NULL)
+		return;	/* GFP_KERNEL so can't happen anyway */
+	memcpy(dmi->dmi_addr, addr, alen);
+	dmi->dmi_addrlen=alen;
+	dmi->dmi_users=1;
+	dev_mc_link(dev,dmi);
+	dev_mc_pack_add(st,DEV_MC_NODE(dmi));
+	dev_mc_hash_add(st,dmi);
+	dev->mc_count++;
+	dev_mc_changed(dev);
+	/*
+	 * 118-126行代码对device结构中mc_list字段指向的多播地址列表进行查询，检查是否有相同
+	 * 的多播地址已经加入到列表中，如果存在，则根据newonly参数的设置，决定是仅仅增加已
+	 * 有地址的使用计数，还是不进行任何操作的返回。
+	 * 代码执行到127行，表示这是一个全新的多播地址，此时分配一个新的dev_mc_list结构，插
+	 * 入到有mc_list指向的列表首部，最后调用dev_mc_upload函数重新启动设备，从而使新加入
+	 * 的多播地址生效
+	 * */
+}
+
+/*
+ *	Discard multicast list when a device is downed
+ *	该函数完成的功能是对device结构
+ *	中mc_list字段指向的列表中所有地址进行释放，这个函数在关闭一个设备时被调用，具体
+ *	的是在dev_close函数（dev.c）中被调用。
+ */
+
+void dev_mc_discard(struct device *dev)
+{
+	struct dev_mc_state *st=dev_mc_state_find(dev);
+	if(st!=NULL)
+	{
+		st->pending=0;
+		st->count=0;
+		st->packed=1;
+		memset(st->hash_count,0,sizeof(st->hash_count));
+		memset(st->hash_filter,0,sizeof(st->hash_filter));
+	}
+	while(dev->mc_list!=NULL)
+		dev_mc_unlink(dev->mc_list);
+	/* The entries all came from here, free them in one go */
+	if(st!=NULL)
+		mc_arena_release(&st->nodes);
+	dev->mc_count=0;
+}
+
+/*
+ *	Upload counters for /proc.
+ */
+ 
+int dev_mc_get_info(char *buffer, char **start, off_t offset, int length, int dummy)
+{
+	struct dev_mc_state *st;
+	int len=0;
+	off_t pos=0;
+	off_t begin=0;
+	
+	len+=sprintf(buffer,"Device   Count  Uploads  Coalesced Delay Batch Pending Limit AllMulti Chunks\n");
+	for(st=dev_mc_states;st!=NULL;st=st->next)
+	{
+		len+=sprintf(buffer+len,"%-8s %5d %8lu %10lu %5d %5d %7d %5d %8d %6d\n",
+			st->dev->name, st->dev->mc_count, st->uploads,
+			st->coalesced, st->delay, st->batch, st->pending,
+			st->limit, st->allmulti, st->nodes.nchunks);
+		pos=begin+len;
+		if(pos<offset)
+		{
+			len=0;
+			begin=pos;
+		}
+		if(pos>offset+length)
+			break;
+	}
+	*start=buffer+(offset-begin);
+	len-=(offset-begin);
+	if(len>length)
+		len=length;
+	return len;
+}
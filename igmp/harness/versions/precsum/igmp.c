@@ -0,0 +1,1770 @@
+/*
+ *	Linux NET3:	Internet Gateway Management Protocol  [IGMP]
+ *
+ *	Authors:
+ *		Alan Cox <Alan.Cox@linux.org>	
+ *
+ *	WARNING:
+ *		This is a 'preliminary' implementation... on your own head
+ *	be it.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+ 
+ 
+#include <asm/segment.h>
+#include <asm/system.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/config.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include "ip.h"
+#include "protocol.h"
+#include "route.h"
+#include <linux/skbuff.h>
+#include "sock.h"
+#include <linux/igmp.h>
+#include "dev_mcast.h"
+
+#ifdef CONFIG_IP_MULTICAST
+
+
+/*
+ *	Group index. Every ip_mc_list we hand out is the front of an
+ *	ip_mc_node, which enters it in a hash keyed on (device, group)
+ *	and remembers the link pointing at it in dev->ip_mc_list. Lookups
+ *	and unlinks no longer walk the device list, which matters once an
+ *	interface carries thousands of groups. The bucket array starts
+ *	small and doubles as groups are added. Nodes are carved from the
+ *	interface's arena, so its groups share a few blocks of memory.
+ *
+ *	The hash chains don't run through the nodes themselves. A node is
+ *	most of 100 bytes with the key at the front and the timer in the
+ *	middle, so a chain walk touched two or three cache lines for every
+ *	entry it passed over. Instead each group has a 16 byte key record,
+ *	from a second arena, holding just what a lookup compares; the node
+ *	is only touched once the key matches. Within the node the fields
+ *	the report timers use come first.
+ */
+
+struct ip_mc_key
+{
+	struct ip_mc_key *next;		/* Hash chain */
+	struct device *dev;
+	unsigned long addr;
+	struct ip_mc_node *node;
+};
+
+struct ip_mc_node
+{
+	struct ip_mc_list im;		/* Must be first */
+	struct ip_mc_node *wheel_next;	/* Report delay wheel */
+	struct ip_mc_node **wheel_pprev;
+	unsigned long expires;		/* Jiffy the report is due */
+	struct ip_mc_key *key;		/* Our entry in the index */
+	struct ip_mc_list **pprev;	/* Link that points at us */
+	unsigned long last_report;	/* When we last answered for it */
+	struct igmphdr igh;		/* v1 report for the group, summed */
+	struct igmp_tmpl *tmpl;		/* Cached headers to the group */
+	int sfcount[2];			/* Users in each filter mode */
+	struct ip_mc_src *sources;	/* Source filter state */
+};
+
+#define IP_MC_NODE(im)	((struct ip_mc_node *)(im))
+
+/*
+ *	IGMPv3 (RFC3376) messages. A report carries any number of group
+ *	records, so one packet can answer a general query for a whole
+ *	interface.
+ */
+
+#ifndef IGMPV3_HOST_MEMBERSHIP_REPORT
+#define IGMPV3_HOST_MEMBERSHIP_REPORT	0x22
+#endif
+
+#define IGMPV3_ALL_MCR		htonl(0xE0000016L)	/* 224.0.0.22 */
+
+/*
+ *	IGMPv2 (RFC2236). Queries carry a Max Response Time in tenths of a
+ *	second in the byte v1 left unused; zero means a v1 querier and the
+ *	old fixed 10 seconds.
+ */
+
+#ifndef IGMP_HOST_NEW_MEMBERSHIP_REPORT
+#define IGMP_HOST_NEW_MEMBERSHIP_REPORT	0x16
+#endif
+
+#ifndef IGMP_ALL_ROUTER
+#define IGMP_ALL_ROUTER		htonl(0xE0000002L)	/* 224.0.0.2 */
+#endif
+
+#define IGMP_MAX_HOST_REPORT_DELAY	10		/* Seconds */
+
+#define IGMPV3_MODE_IS_INCLUDE		1
+#define IGMPV3_MODE_IS_EXCLUDE		2
+#define IGMPV3_CHANGE_TO_INCLUDE	3
+#define IGMPV3_CHANGE_TO_EXCLUDE	4
+#define IGMPV3_ALLOW_NEW_SOURCES	5
+#define IGMPV3_BLOCK_OLD_SOURCES	6
+
+struct igmpv3_query
+{
+	unsigned char type;
+	unsigned char code;
+	unsigned short csum;
+	unsigned long group;
+	unsigned char qrv;		/* Suppress flag and robustness */
+	unsigned char qqic;
+	unsigned short nsrcs;
+};
+
+struct igmpv3_report
+{
+	unsigned char type;
+	unsigned char resv1;
+	unsigned short csum;
+	unsigned short resv2;
+	unsigned short ngrec;
+};
+
+struct igmpv3_grec
+{
+	unsigned char grec_type;
+	unsigned char grec_auxwords;
+	unsigned short grec_nsrcs;
+	unsigned long grec_mca;
+};
+
+/*
+ *	Per device IGMP state. We answer in the version of the last query
+ *	heard on the interface; until a v2 or v3 querier speaks we behave as
+ *	the v1 host we always were. In v3 mode a general query is answered by
+ *	one interface timer that reports every group in as few packets as
+ *	the MTU allows.
+ */
+
+struct igmp_dev
+{
+	struct igmp_dev *next;
+	struct device *dev;
+	int querier;			/* Version of the last query heard */
+	int report_pending;		/* report_timer is running */
+	struct timer_list report_timer;
+	unsigned long rnd;		/* Report delay generator, 0 until seeded */
+	struct igmp_tmpl *leave;	/* Cached headers to all routers */
+	struct igmp_tmpl *v3;		/* Cached headers to all v3 routers */
+	struct mc_arena nodes;		/* Our groups' ip_mc_nodes */
+	struct mc_arena keys;		/* And their index keys */
+};
+
+static struct igmp_dev *igmp_devs=NULL;
+
+static void igmpv3_report_expire(unsigned long data);
+static void igmp_tmpl_free(struct igmp_tmpl *t);
+
+static struct igmp_dev *igmp_dev_find(struct device *dev)
+{
+	struct igmp_dev *igd;
+	for(igd=igmp_devs;igd!=NULL;igd=igd->next)
+		if(igd->dev==dev)
+			return igd;
+	return NULL;
+}
+
+static struct igmp_dev *igmp_dev_get(struct device *dev)
+{
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	if(igd!=NULL)
+		return igd;
+	igd=(struct igmp_dev *)kmalloc(sizeof(*igd), GFP_KERNEL);
+	if(igd==NULL)
+		return NULL;
+	igd->dev=dev;
+	igd->querier=1;
+	igd->report_pending=0;
+	igd->rnd=0;
+	igd->leave=NULL;
+	igd->v3=NULL;
+	mc_arena_init(&igd->nodes,sizeof(struct ip_mc_node));
+	mc_arena_init(&igd->keys,sizeof(struct ip_mc_key));
+	init_timer(&igd->report_timer);
+	igd->report_timer.data=(unsigned long)igd;
+	igd->report_timer.function=&igmpv3_report_expire;
+	igd->next=igmp_devs;
+	igmp_devs=igd;
+	return igd;
+}
+
+static void igmp_dev_drop(struct device *dev)
+{
+	struct igmp_dev **igdp;
+	for(igdp=&igmp_devs;*igdp!=NULL;igdp=&(*igdp)->next)
+	{
+		if((*igdp)->dev==dev)
+		{
+			struct igmp_dev *igd= *igdp;
+			if(igd->report_pending)
+				del_timer(&igd->report_timer);
+			*igdp=igd->next;
+			igmp_tmpl_free(igd->leave);
+			igmp_tmpl_free(igd->v3);
+			mc_arena_release(&igd->nodes);
+			mc_arena_release(&igd->keys);
+			kfree_s(igd,sizeof(*igd));
+			return;
+		}
+	}
+}
+
+static inline int igmp_querier(struct device *dev)
+{
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	return igd ? igd->querier : 1;
+}
+
+
+/*
+ *	Source filters (RFC3376 section 3). A membership is either INCLUDE
+ *	with the sources it wants or EXCLUDE with the sources it blocks; an
+ *	ordinary join is EXCLUDE with none. For each group we count the
+ *	users in each mode and, per source, how many include or exclude it.
+ *	From that the interface filter falls out: in EXCLUDE mode if any user
+ *	is, blocking only what every EXCLUDE user blocks and no INCLUDE user
+ *	wants; otherwise INCLUDE of everything anybody wants. Sources live in
+ *	a hash on (group, source) so the receive path can check a packet
+ *	without walking lists.
+ */
+
+#ifndef MCAST_EXCLUDE
+#define MCAST_EXCLUDE	0
+#define MCAST_INCLUDE	1
+#endif
+
+struct ip_mc_src
+{
+	struct ip_mc_src *hash_next;
+	struct ip_mc_src *next;		/* Group's sources */
+	struct ip_mc_list *im;
+	unsigned long addr;
+	int count[2];			/* Users including/excluding it */
+};
+
+#define IP_MC_SRC_HASH	1024		/* Must be a power of two */
+
+static struct ip_mc_src *ip_mc_shash[IP_MC_SRC_HASH];
+
+static inline unsigned int ip_mc_shashfn(struct ip_mc_list *im, unsigned long addr)
+{
+	unsigned long h=ntohl(addr)^((unsigned long)im>>4);
+	h^=h>>16;
+	h^=h>>8;
+	return h&(IP_MC_SRC_HASH-1);
+}
+
+static struct ip_mc_src *ip_mc_src_find(struct ip_mc_list *im, unsigned long addr)
+{
+	struct ip_mc_src *ps=ip_mc_shash[ip_mc_shashfn(im,addr)];
+	for(;ps!=NULL;ps=ps->hash_next)
+		if(ps->addr==addr && ps->im==im)
+			return ps;
+	return NULL;
+}
+
+static void ip_mc_src_add(struct ip_mc_list *im, int mode, unsigned long addr)
+{
+	struct ip_mc_src *ps=ip_mc_src_find(im,addr);
+	unsigned int h;
+	
+	if(ps==NULL)
+	{
+		ps=(struct ip_mc_src *)kmalloc(sizeof(*ps), GFP_KERNEL);
+		if(ps==NULL)
+			return;
+		ps->im=im;
+		ps->addr=addr;
+		ps->count[MCAST_EXCLUDE]=0;
+		ps->count[MCAST_INCLUDE]=0;
+		h=ip_mc_shashfn(im,addr);
+		ps->hash_next=ip_mc_shash[h];
+		ip_mc_shash[h]=ps;
+		ps->next=IP_MC_NODE(im)->sources;
+		IP_MC_NODE(im)->sources=ps;
+	}
+	ps->count[mode]++;
+}
+
+static void ip_mc_src_free(struct ip_mc_src *ps)
+{
+	struct ip_mc_src **psp;
+	for(psp=&ip_mc_shash[ip_mc_shashfn(ps->im,ps->addr)];*psp!=NULL;psp=&(*psp)->hash_next)
+	{
+		if(*psp==ps)
+		{
+			*psp=ps->hash_next;
+			break;
+		}
+	}
+	kfree_s(ps,sizeof(*ps));
+}
+
+static void ip_mc_src_del(struct ip_mc_list *im, int mode, unsigned long addr)
+{
+	struct ip_mc_src **psp, *ps;
+	for(psp=&IP_MC_NODE(im)->sources;(ps= *psp)!=NULL;psp=&ps->next)
+	{
+		if(ps->addr!=addr)
+			continue;
+		if(ps->count[mode])
+			ps->count[mode]--;
+		if(ps->count[MCAST_EXCLUDE]==0 && ps->count[MCAST_INCLUDE]==0)
+		{
+			*psp=ps->next;
+			ip_mc_src_free(ps);
+		}
+		return;
+	}
+}
+
+static void ip_mc_src_flush(struct ip_mc_list *im)
+{
+	struct ip_mc_src *ps;
+	while((ps=IP_MC_NODE(im)->sources)!=NULL)
+	{
+		IP_MC_NODE(im)->sources=ps->next;
+		ip_mc_src_free(ps);
+	}
+}
+
+/*
+ *	Is this source in the interface filter list for its group? In
+ *	EXCLUDE mode the list is what is blocked, in INCLUDE mode what is
+ *	wanted.
+ */
+ 
+static inline int ip_mc_src_listed(struct ip_mc_list *im, struct ip_mc_src *ps)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	if(n->sfcount[MCAST_EXCLUDE])
+		return ps->count[MCAST_EXCLUDE]==n->sfcount[MCAST_EXCLUDE] && ps->count[MCAST_INCLUDE]==0;
+	return ps->count[MCAST_INCLUDE]!=0;
+}
+
+/*
+ *	Timer management
+ */
+ 
+/*当一个主机首次发送IGMP报告（当第一个进程加入一个多
+ * 播组）时，并不保证该报告被可靠接收（因为使用的是IP交付服务）。下一个报告将在间隔
+ * 一段时间后发送。这个时间间隔由主机在0-10秒的范围内随机选择。其次，当一个主机收到
+ * 一个从路由器发出的查询后，并不立即响应，而是经过一定的时间间隔后才发出一些响应。
+ * 因为多播路由器并不关心有多少主机属于该组，而只关心该组是否还至少拥有一个主机。
+ * 这意味着如果一个主机在等待发送报告的过程中，却收到了发自其他主机的相同报告，则该
+ * 主机的响应就可以不必发送了。igmp_stop_timer函数被两个函数调用：igmp_timer_expire，
+ * igmp_heard_report。igmp_heard_report函数在接收到同组其他主机发送的IGMP报告报文时
+ * 被调用，依据以上的设计思想，此时可以不发送报文。所以停止定时器。igmp_timer_expire
+ * 则表示定时器正常到期，此时发送一个IGMP报告报文，在发送报告报文的同时，也停止定时
+ * 器。本版本并未实现IGMP报告报文的主动通知，而是响应一个IGMP查询报文时，才发送IGMP
+ * 报告报文，在发送时，如上所述，将延迟一段0-10秒的随机时间，如果在这段时间内接收到
+ * 相同子网内其他主机的IGMP报告报文，则中断定时器延迟，取消发送。否则定时器正常到期，
+ * 发送一个IGMP报告报文，这通常是延迟时间最短的主机发送的第一个IGMP报告报文
+ *
+ * */ 
+
+/*
+ *	Report delays run off one timer wheel rather than a kernel timer per
+ *	group. A general query on an interface with thousands of groups then
+ *	costs a list insert per group instead of an add_timer, and the wheel
+ *	timer sends everything that has come due in one pass. Each slot is a
+ *	jiffy; delays longer than the wheel go round again until due.
+ */
+
+#define IGMP_WHEEL_SIZE	256		/* Must be a power of two */
+
+static struct ip_mc_node *igmp_wheel[IGMP_WHEEL_SIZE];
+static unsigned long igmp_wheel_clock;	/* Last jiffy processed */
+static int igmp_wheel_count=0;
+static struct timer_list igmp_wheel_timer;
+
+static void igmp_stop_timer(struct ip_mc_list *im)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	if(!im->tm_running)
+		return;
+	*n->wheel_pprev=n->wheel_next;
+	if(n->wheel_next!=NULL)
+		n->wheel_next->wheel_pprev=n->wheel_pprev;
+	im->tm_running=0;
+	if(--igmp_wheel_count==0)
+		del_timer(&igmp_wheel_timer);
+}
+
+/*
+ *	Report delays. Suppression only works if the hosts on a segment
+ *	pick different delays, and the old shared LCG with a fixed seed
+ *	had hosts booted together choosing the same ones. Each interface
+ *	now runs its own xorshift generator, seeded on first use from its
+ *	hardware and IP addresses and the time.
+ */
+ 
+static unsigned long igmp_rnd_any=0;	/* For a device with no state */
+
+static unsigned long igmp_seed(struct device *dev)
+{
+	unsigned long h=jiffies^ntohl(dev->pa_addr);
+	int i;
+	for(i=0;i<dev->addr_len;i++)
+		h=(h*31)+dev->dev_addr[i];
+	h=(h*2654435761UL)&0xFFFFFFFF;
+	return h ? h : 152;
+}
+
+static unsigned long igmp_random(struct device *dev)
+{
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	unsigned long *state=(igd!=NULL) ? &igd->rnd : &igmp_rnd_any;
+	unsigned long x=*state;
+	
+	if(x==0)
+		x=igmp_seed(dev);
+	x^=(x<<13)&0xFFFFFFFF;
+	x^=x>>17;
+	x^=(x<<5)&0xFFFFFFFF;
+	*state=x;
+	return x;
+}
+
+/*
+ *	Counters for /proc, to see how well suppression is working. Chosen
+ *	delays are kept as a histogram in tenths of the allowed window; a
+ *	report heard for a group within IGMP_DUP_WINDOW of our own answer
+ *	counts as a duplicate.
+ */
+ 
+#define IGMP_DELAY_BUCKETS	10
+#define IGMP_DUP_WINDOW		(HZ/10)
+
+static struct igmp_stats
+{
+	unsigned long queries;		/* Queries heard */
+	unsigned long reports;		/* Query answers we sent */
+	unsigned long suppressed;	/* Answers another host made for us */
+	unsigned long duplicates;	/* Reports heard just after ours */
+	unsigned long delays[IGMP_DELAY_BUCKETS];
+	unsigned long pool_hits;	/* Sends served from the reserve */
+	unsigned long pool_misses;	/* Reserve empty, allocated instead */
+	unsigned long pool_drops;	/* Nothing to send with at all */
+} igmp_stats;
+
+/*
+ * igmp_start_timer函数被igmp_heard_query函数调用，当接收到路由器发送的IGMP查询报文
+ * 时，设置一个0-10秒内随机延迟时间的定时器，在定时器到期后，发送一个IMGP报告报文。
+ * 注意这个定时器是作为ip_mc_list结构中一个字段存在的。这个定时器的初始化是在
+ * igmp_init_timer函数中完成的
+ * */
+static void igmp_wheel_expire(unsigned long data);
+
+static void igmp_start_timer(struct ip_mc_list *im, int max_delay)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	struct ip_mc_node **slot;
+	unsigned int tv;
+	/* A running delay is only cut short, never stretched (RFC2236) */
+	if(im->tm_running)
+	{
+		if((long)(n->expires-jiffies)<=max_delay)
+			return;
+		igmp_stop_timer(im);
+	}
+	tv=igmp_random(im->interface)%max_delay;	/* Pick a number any number 8) */
+	igmp_stats.delays[tv*IGMP_DELAY_BUCKETS/max_delay]++;
+	if(igmp_wheel_count++==0)
+	{
+		igmp_wheel_clock=jiffies;
+		init_timer(&igmp_wheel_timer);
+		igmp_wheel_timer.function=&igmp_wheel_expire;
+		igmp_wheel_timer.expires=1;
+		add_timer(&igmp_wheel_timer);
+	}
+	/* Must land after the clock or the wheel would pass it by */
+	n->expires=jiffies+(tv ? tv : 1);
+	slot=&igmp_wheel[n->expires&(IGMP_WHEEL_SIZE-1)];
+	n->wheel_next=*slot;
+	if(n->wheel_next!=NULL)
+		n->wheel_next->wheel_pprev=&n->wheel_next;
+	n->wheel_pprev=slot;
+	*slot=n;
+	im->tm_running=1;
+}
+ 
+/*
+ *	Send an IGMP report.
+ *	igmp_send_report函数完成发送一个IMGP报告报文的功能。经过本书前文中对TCP，UDP，ICMP
+ *	等协议的介绍，相信读者对于发送一个数据包时所需要进行的工作进行很了解了：主要是完
+ *	成对各协议首部的创建。用户数据的封装简单的说就是将数据从用户缓冲区复制到指定的内
+ *	核缓冲区中。虽然如同ICMP协议一样，一般我们也将IGMP协议认为是网络层协议，但实现上
+ *	IGMP报文中传输是封装在IP报文之中的，所以协议首部的创建包括MAC，IP，IGMP首部。对
+ *	于MAC, IP首部通过ip_build_header函数完成（这个函数在介绍ICMP，TCP，UDP协议时已经
+ *	多次遇到），所以创建首部的工作主要针对IGMP首部。由于IGMP首部格式简单，长度固定，
+ *	所以这个工作一目了然。值得注意的是在调用ip_build_header函数传入的多播IP地址（多
+ *	播MAC地址根据多播IP地址构建)
+ */
+
+#define MAX_IGMP_SIZE (sizeof(struct igmphdr)+sizeof(struct iphdr)+64)
+
+/*
+ *	Reports go out from timers, where only GFP_ATOMIC allocations can
+ *	be made, and a failed one loses the report and in time the group
+ *	on the router. A few buffers are put aside from process context for
+ *	such sends and topped up again whenever we can. Any report that
+ *	fits, v3 records for a single group included, is served from them
+ *	first.
+ */
+
+#define IGMP_POOL_SIZE	16		/* Buffers held back */
+#define IGMP_POOL_SKB	256		/* Bytes in each */
+
+static struct sk_buff_head igmp_pool;
+static int igmp_pool_ready=0;
+
+static void igmp_pool_fill(int priority)
+{
+	struct sk_buff *skb;
+	
+	if(!igmp_pool_ready)
+	{
+		skb_queue_head_init(&igmp_pool);
+		igmp_pool_ready=1;
+	}
+	while(igmp_pool.qlen<IGMP_POOL_SIZE)
+	{
+		skb=alloc_skb(IGMP_POOL_SKB, priority);
+		if(skb==NULL)
+			return;
+		skb_queue_tail(&igmp_pool,skb);
+	}
+}
+
+static struct sk_buff *igmp_alloc_skb(unsigned int size)
+{
+	struct sk_buff *skb=NULL;
+	
+	if(size<=IGMP_POOL_SKB && igmp_pool_ready)
+		skb=skb_dequeue(&igmp_pool);
+	if(skb!=NULL)
+	{
+		igmp_stats.pool_hits++;
+		return skb;
+	}
+	skb=alloc_skb(size, GFP_ATOMIC);
+	if(skb!=NULL)
+		igmp_stats.pool_misses++;
+	else
+		igmp_stats.pool_drops++;
+	return skb;
+}
+
+/*
+ *	The MAC and IP headers of a report never change for a given device
+ *	and destination, so the first ip_build_header() result is kept and
+ *	copied into later frames. ip_queue_xmit() fills in the length, id
+ *	and header checksum as always. A template is only kept once the
+ *	MAC header resolved, and is rebuilt if the interface address moves.
+ *	Groups keep their own (to the group), devices one each for leaves
+ *	and v3 reports.
+ */
+
+struct igmp_tmpl
+{
+	unsigned long pa_addr;		/* Interface address it was built for */
+	unsigned long saddr;		/* What ip_build_header chose */
+	unsigned long raddr;
+	int hlen;			/* Bytes of header following */
+};
+
+static void igmp_tmpl_free(struct igmp_tmpl *t)
+{
+	if(t!=NULL)
+		kfree_s(t,sizeof(*t)+t->hlen);
+}
+
+static int igmp_build_header(struct sk_buff *skb, struct device *dev, unsigned long dst,
+	struct igmp_tmpl **tp)
+{
+	struct igmp_tmpl *t=(tp!=NULL) ? *tp : NULL;
+	struct device *odev=dev;
+	int tmp;
+	
+	if(t!=NULL && t->pa_addr==dev->pa_addr)
+	{
+		memcpy(skb->data,t+1,t->hlen);
+		skb->dev=dev;
+		skb->saddr=t->saddr;
+		skb->raddr=t->raddr;
+		skb->arp=1;
+		return t->hlen;
+	}
+	tmp=ip_build_header(skb, INADDR_ANY, dst, &dev, IPPROTO_IGMP, NULL,
+				skb->mem_len, 0, 1);
+	if(tp==NULL || tmp<0)
+		return tmp;
+	if(t!=NULL && (t->hlen!=tmp || !skb->arp || dev!=odev))
+	{
+		igmp_tmpl_free(t);
+		*tp=t=NULL;
+	}
+	if(!skb->arp || dev!=odev)
+		return tmp;
+	if(t==NULL)
+	{
+		t=(struct igmp_tmpl *)kmalloc(sizeof(*t)+tmp, GFP_ATOMIC);
+		if(t==NULL)
+			return tmp;
+		t->hlen=tmp;
+		*tp=t;
+	}
+	t->pa_addr=dev->pa_addr;
+	t->saddr=skb->saddr;
+	t->raddr=skb->raddr;
+	memcpy(t+1,skb->data,tmp);
+	return tmp;
+}
+
+/*
+ *	Change the type of a summed header without summing it again
+ *	(RFC1624: HC' = ~(~HC + ~m + m')).
+ */
+ 
+static void igmp_retype(struct igmphdr *igh, int type)
+{
+	unsigned short old=*(unsigned short *)igh;
+	unsigned long sum;
+	
+	igh->type=type;
+	sum=(~igh->csum&0xFFFF)+(~old&0xFFFF)+*(unsigned short *)igh;
+	sum=(sum&0xFFFF)+(sum>>16);
+	sum+=sum>>16;
+	igh->csum=~sum;
+}
+
+static void igmp_send_report(struct ip_mc_list *im, int type)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	struct device *dev=im->interface;
+	struct sk_buff *skb=igmp_alloc_skb(MAX_IGMP_SIZE);
+	struct igmp_tmpl **tp=&n->tmpl;
+	unsigned long dst=im->multiaddr;
+	struct igmphdr *igh;
+	int tmp;
+	
+	if(skb==NULL)
+		return;
+	/* Leaves are for the routers, not the other members */
+	if(type==IGMP_HOST_LEAVE_MESSAGE)
+	{
+		struct igmp_dev *igd=igmp_dev_find(dev);
+		dst=IGMP_ALL_ROUTER;
+		tp=(igd!=NULL) ? &igd->leave : NULL;
+	}
+	tmp=igmp_build_header(skb, dev, dst, tp);
+	if(tmp<0)
+	{
+		kfree_skb(skb, FREE_WRITE);
+		return;
+	}
+	igh=(struct igmphdr *)(skb->data+tmp);
+	skb->len=tmp+sizeof(*igh);
+	*igh=n->igh;
+	if(igh->type!=type)
+		igmp_retype(igh,type);
+	ip_queue_xmit(NULL,dev,skb,1);
+}
+
+/*
+ *	Send IGMPv3 records for one group or, with im NULL, for every group
+ *	on the device. Records carry the interface source filter; they are
+ *	current state records in answer to a query, or filter mode change
+ *	records when our state has changed. Records are packed up to the
+ *	device MTU so a whole interface usually goes in a packet or two. A
+ *	source list too long for one packet is cut short.
+ */
+
+#define IGMPV3_SIZE(n)	(sizeof(struct iphdr)+sizeof(struct igmpv3_report)+(n)+64)
+
+static int igmpv3_grec_size(struct ip_mc_list *im, int space)
+{
+	struct ip_mc_src *ps;
+	int size=sizeof(struct igmpv3_grec);
+	for(ps=IP_MC_NODE(im)->sources;ps!=NULL;ps=ps->next)
+		if(ip_mc_src_listed(im,ps) && size+sizeof(unsigned long)<=space)
+			size+=sizeof(unsigned long);
+	return size;
+}
+
+static void igmpv3_fill_grec(struct igmpv3_grec *grec, struct ip_mc_list *im, int change, int size)
+{
+	unsigned long *src=(unsigned long *)(grec+1);
+	struct ip_mc_src *ps;
+	int n=0;
+	int max=(size-sizeof(*grec))/sizeof(unsigned long);
+	
+	if(IP_MC_NODE(im)->sfcount[MCAST_EXCLUDE])
+		grec->grec_type=change ? IGMPV3_CHANGE_TO_EXCLUDE : IGMPV3_MODE_IS_EXCLUDE;
+	else
+		grec->grec_type=change ? IGMPV3_CHANGE_TO_INCLUDE : IGMPV3_MODE_IS_INCLUDE;
+	grec->grec_auxwords=0;
+	grec->grec_mca=im->multiaddr;
+	for(ps=IP_MC_NODE(im)->sources;ps!=NULL && n<max;ps=ps->next)
+		if(ip_mc_src_listed(im,ps))
+			src[n++]=ps->addr;
+	grec->grec_nsrcs=htons(n);
+}
+
+static void igmpv3_send_report(struct device *dev, struct ip_mc_list *im, int change)
+{
+	struct ip_mc_list *i=(im!=NULL) ? im : dev->ip_mc_list;
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	struct sk_buff *skb;
+	struct igmpv3_report *rep;
+	unsigned char *data;
+	int space, size, used, len, n, tmp;
+	
+	space=dev->mtu-sizeof(struct iphdr)-sizeof(struct igmpv3_report);
+	size=(im!=NULL) ? igmpv3_grec_size(im,space) : space;
+	while(i!=NULL)
+	{
+		skb=igmp_alloc_skb(IGMPV3_SIZE(size));
+		if(skb==NULL)
+			return;
+		tmp=igmp_build_header(skb, dev, IGMPV3_ALL_MCR, (igd!=NULL) ? &igd->v3 : NULL);
+		if(tmp<0)
+		{
+			kfree_skb(skb, FREE_WRITE);
+			return;
+		}
+		rep=(struct igmpv3_report *)(skb->data+tmp);
+		data=(unsigned char *)(rep+1);
+		used=0;
+		for(n=0;i!=NULL;i=(im!=NULL) ? NULL : i->next)
+		{
+			/* Everyone is in all hosts, it is never reported */
+			if(i->multiaddr==IGMP_ALL_HOSTS)
+				continue;
+			len=igmpv3_grec_size(i,space);
+			if(used+len>size)
+				break;
+			igmpv3_fill_grec((struct igmpv3_grec *)(data+used), i, change, len);
+			used+=len;
+			n++;
+		}
+		if(n==0)
+		{
+			kfree_skb(skb, FREE_WRITE);
+			return;
+		}
+		rep->type=IGMPV3_HOST_MEMBERSHIP_REPORT;
+		rep->resv1=0;
+		rep->csum=0;
+		rep->resv2=0;
+		rep->ngrec=htons(n);
+		skb->len=tmp+sizeof(*rep)+used;
+		rep->csum=ip_compute_csum((void *)rep,sizeof(*rep)+used);
+		ip_queue_xmit(NULL,dev,skb,1);
+	}
+}
+
+static void igmpv3_report_expire(unsigned long data)
+{
+	struct igmp_dev *igd=(struct igmp_dev *)data;
+	igd->report_pending=0;
+	igmpv3_send_report(igd->dev, NULL, 0);
+	igmp_pool_fill(GFP_ATOMIC);
+}
+
+/*
+ *	Answer a group the way the querier on its interface expects.
+ */
+ 
+static void igmp_report_group(struct ip_mc_list *im)
+{
+	igmp_stats.reports++;
+	IP_MC_NODE(im)->last_report=jiffies;
+	switch(igmp_querier(im->interface))
+	{
+		case 3:
+			igmpv3_send_report(im->interface, im, 0);
+			break;
+		case 2:
+			igmp_send_report(im, IGMP_HOST_NEW_MEMBERSHIP_REPORT);
+			break;
+		default:
+			igmp_send_report(im, IGMP_HOST_MEMBERSHIP_REPORT);
+	}
+}
+
+
+/*
+ *	Walk the wheel up to now, reporting every group whose delay is up.
+ *	If the timer ran late we catch up a slot at a time.
+ */
+ 
+static void igmp_wheel_expire(unsigned long data)
+{
+	struct ip_mc_node *n, *next;
+	
+	while(igmp_wheel_count && igmp_wheel_clock!=jiffies)
+	{
+		igmp_wheel_clock++;
+		for(n=igmp_wheel[igmp_wheel_clock&(IGMP_WHEEL_SIZE-1)];n!=NULL;n=next)
+		{
+			next=n->wheel_next;
+			if(n->expires!=igmp_wheel_clock)
+				continue;
+			igmp_stop_timer(&n->im);
+			igmp_report_group(&n->im);
+		}
+	}
+	igmp_pool_fill(GFP_ATOMIC);
+	if(igmp_wheel_count)
+	{
+		igmp_wheel_timer.expires=1;
+		add_timer(&igmp_wheel_timer);
+	}
+}
+
+static void igmp_init_timer(struct ip_mc_list *im)
+{
+	im->tm_running=0;
+}
+	
+/*
+ *	Group index buckets.
+ */
+
+#define IP_MC_HASH_MIN	64
+#define IP_MC_HASH_MAX	16384		/* Keep the buckets in one kmalloc */
+
+static struct ip_mc_key *ip_mc_hash_min[IP_MC_HASH_MIN];
+static struct ip_mc_key **ip_mc_hash=ip_mc_hash_min;
+static unsigned int ip_mc_hash_size=IP_MC_HASH_MIN;
+static unsigned int ip_mc_hash_count=0;
+
+static inline unsigned int ip_mc_hashfn(struct device *dev, unsigned long addr, unsigned int size)
+{
+	unsigned long h=ntohl(addr)^((unsigned long)dev>>4);
+	h^=h>>16;
+	h^=h>>8;
+	return h&(size-1);
+}
+
+static struct ip_mc_list *ip_mc_find(struct device *dev, unsigned long addr)
+{
+	struct ip_mc_key *k=ip_mc_hash[ip_mc_hashfn(dev,addr,ip_mc_hash_size)];
+	for(;k!=NULL;k=k->next)
+		if(k->addr==addr && k->dev==dev)
+			return &k->node->im;
+	return NULL;
+}
+
+/*
+ *	Double the bucket array. If the memory isn't there we just carry
+ *	on with longer chains.
+ */
+ 
+static void ip_mc_hash_grow(void)
+{
+	struct ip_mc_key **nh, *k, *next;
+	unsigned int size=ip_mc_hash_size*2;
+	unsigned int i, h;
+	
+	nh=(struct ip_mc_key **)kmalloc(size*sizeof(*nh), GFP_KERNEL);
+	if(nh==NULL)
+		return;
+	memset(nh,0,size*sizeof(*nh));
+	for(i=0;i<ip_mc_hash_size;i++)
+	{
+		for(k=ip_mc_hash[i];k!=NULL;k=next)
+		{
+			next=k->next;
+			h=ip_mc_hashfn(k->dev,k->addr,size);
+			k->next=nh[h];
+			nh[h]=k;
+		}
+	}
+	if(ip_mc_hash!=ip_mc_hash_min)
+		kfree_s(ip_mc_hash,ip_mc_hash_size*sizeof(*ip_mc_hash));
+	ip_mc_hash=nh;
+	ip_mc_hash_size=size;
+}
+
+/*
+ *	Allocate a group. It isn't visible until ip_mc_link puts it on the
+ *	front of the device list and into the index.
+ */
+ 
+static struct ip_mc_list *ip_mc_alloc(struct device *dev, unsigned long addr)
+{
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	struct ip_mc_node *n;
+	
+	if(igd==NULL)
+		return NULL;
+	if(ip_mc_hash_count>=ip_mc_hash_size && ip_mc_hash_size<IP_MC_HASH_MAX)
+		ip_mc_hash_grow();
+	n=(struct ip_mc_node *)mc_arena_alloc(&igd->nodes, GFP_KERNEL);
+	if(n==NULL)
+		return NULL;
+	n->key=(struct ip_mc_key *)mc_arena_alloc(&igd->keys, GFP_KERNEL);
+	if(n->key==NULL)
+	{
+		mc_arena_free(&igd->nodes,n);
+		return NULL;
+	}
+	n->key->dev=dev;
+	n->key->addr=addr;
+	n->key->node=n;
+	n->im.users=1;
+	n->im.interface=dev;
+	n->im.multiaddr=addr;
+	n->im.tm_running=0;
+	n->last_report=jiffies-IGMP_DUP_WINDOW;
+	n->sfcount[MCAST_EXCLUDE]=0;
+	n->sfcount[MCAST_INCLUDE]=0;
+	n->sources=NULL;
+	n->tmpl=NULL;
+	n->igh.type=IGMP_HOST_MEMBERSHIP_REPORT;
+	n->igh.unused=0;
+	n->igh.csum=0;
+	n->igh.group=addr;
+	n->igh.csum=ip_compute_csum((void *)&n->igh,sizeof(n->igh));
+	return &n->im;
+}
+
+static void ip_mc_link(struct ip_mc_list *im)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	struct device *dev=im->interface;
+	unsigned int h;
+	
+	im->next=dev->ip_mc_list;
+	if(im->next!=NULL)
+		IP_MC_NODE(im->next)->pprev=&im->next;
+	n->pprev=&dev->ip_mc_list;
+	dev->ip_mc_list=im;
+	h=ip_mc_hashfn(dev,im->multiaddr,ip_mc_hash_size);
+	n->key->next=ip_mc_hash[h];
+	ip_mc_hash[h]=n->key;
+	ip_mc_hash_count++;
+}
+
+/*
+ *	Take a group off the device list and out of the index. The caller
+ *	frees it.
+ */
+ 
+static void ip_mc_unlink(struct ip_mc_list *im)
+{
+	struct ip_mc_node *n=IP_MC_NODE(im);
+	struct ip_mc_key **kp;
+	
+	*n->pprev=im->next;
+	if(im->next!=NULL)
+		IP_MC_NODE(im->next)->pprev=n->pprev;
+	kp=&ip_mc_hash[ip_mc_hashfn(im->interface,im->multiaddr,ip_mc_hash_size)];
+	for(;*kp!=NULL;kp=&(*kp)->next)
+	{
+		if(*kp==n->key)
+		{
+			*kp=n->key->next;
+			break;
+		}
+	}
+	ip_mc_hash_count--;
+}
+
+
+
+/*
+ *igmp_heard_report函数以及igmp_heard_query函数顾名思义是在分别接收到IGMP报告报文
+ 和IGMP查询报文时被调用。对于IGMP报告报文的情况，由于路由器并不关心哪台主机加入到
+ 那个多播组，而只关心是否有主机在某个多播组中，所以对于一个加入某个多播组的主机而
+ 言，如果其他主机已经发送这个多播组的报告报文，那么本机就不需要再发送这样的报告报
+ 文，igmp_heard_report函数完成的工作即是如此，但接收到一个有其他主机发送的IGMP报
+ 告报文时，其检查本机中是否也设置了发送针对同一多播组的IGMP报告报文定时器，如果有，
+ 则停止该定时器。注意函数实现中是对多播IP地址的检查，是对device结构中ip_mc_list
+ 指向的多播IP地址列表的遍历。对于IGMP查询报文，如果本机有任何加入除了全主机多播组
+ 之外的其他多播组，则必须将此多播组报告给路由器，此时设置一个定时器，在延迟0-10秒
+ 的随机时间后，发送这样一个报告报文，igmp_heared_query函数完成的工作即如此。对
+ 于全主机多播组是无须进行报告的，因为默认的凡是支持多播的主机，默认的都要进入该多
+ 播组
+ * */
+static void igmp_heard_report(struct device *dev, unsigned long address)
+{
+	struct ip_mc_list *im;
+	/* IGMPv3 hosts don't suppress - the router wants every report */
+	if(igmp_querier(dev)==3)
+		return;
+	im=ip_mc_find(dev,address);
+	if(im==NULL)
+		return;
+	if(im->tm_running)
+	{
+		igmp_stats.suppressed++;
+		igmp_stop_timer(im);
+	}
+	else if(jiffies-IP_MC_NODE(im)->last_report<IGMP_DUP_WINDOW)
+		igmp_stats.duplicates++;
+}
+
+/*
+ *	IGMPv3 Max Resp Code in jiffies. Codes from 128 up are a floating
+ *	point value in tenths of a second.
+ */
+ 
+static int igmpv3_mrt(unsigned char code)
+{
+	unsigned long mrt=code;
+	if(code>=128)
+		mrt=((code&0x0F)|0x10)<<(((code>>4)&0x07)+3);
+	mrt=mrt*HZ/10;
+	return mrt ? mrt : 1;
+}
+
+static void igmp_heard_query(struct device *dev, struct igmphdr *igh, int len)
+{
+	struct igmp_dev *igd=igmp_dev_find(dev);
+	struct ip_mc_list *im;
+	int max_delay;
+	
+	igmp_stats.queries++;
+	if(len>=sizeof(struct igmpv3_query) && igd!=NULL)
+	{
+		struct igmpv3_query *ih3=(struct igmpv3_query *)igh;
+		igd->querier=3;
+		max_delay=igmpv3_mrt(ih3->code);
+		if(ih3->group!=0)
+		{
+			im=ip_mc_find(dev,ih3->group);
+			if(im!=NULL)
+				igmp_start_timer(im,max_delay);
+			return;
+		}
+		if(igd->report_pending)
+			return;
+		igd->report_timer.expires=igmp_random(dev)%max_delay+1;
+		igd->report_pending=1;
+		add_timer(&igd->report_timer);
+		return;
+	}
+	if(igh->unused==0)
+	{
+		/* IGMPv1 querier */
+		max_delay=IGMP_MAX_HOST_REPORT_DELAY*HZ;
+		if(igd!=NULL)
+			igd->querier=1;
+	}
+	else
+	{
+		max_delay=igh->unused*HZ/10;
+		if(max_delay==0)
+			max_delay=1;
+		if(igd!=NULL)
+			igd->querier=2;
+	}
+	/* A query sent to a group only asks about that group */
+	if(igh->group!=0)
+	{
+		im=ip_mc_find(dev,igh->group);
+		if(im!=NULL)
+			igmp_start_timer(im,max_delay);
+		return;
+	}
+	for(im=dev->ip_mc_list;im!=NULL;im=im->next)
+		if(im->multiaddr!=IGMP_ALL_HOSTS)
+			igmp_start_timer(im,max_delay);
+}
+
+/*
+ *	Map a multicast IP onto multicast MAC for type ethernet.
+ *	ip_mc_map函数完成多播IP地址到多播MAC地址之间的映射。参数addr表示多播IP地址，由此
+ *	映射而成的MAC地址被填充到buf参数中而返回。
+ */
+ 
+static void ip_mc_map(unsigned long addr, char *buf)
+{
+	addr=ntohl(addr);
+	buf[0]=0x01;
+	buf[1]=0x00;
+	buf[2]=0x5e;
+	buf[5]=addr&0xFF;
+	addr>>=8;
+	buf[4]=addr&0xFF;
+	addr>>=8;
+	buf[3]=addr&0x7F;
+}
+
+/*
+ *	Add a filter to a device
+ *	到对于多播地址的维护是分为三个不同方面进
+ *	行的。设备本身维护MAC地址列表，因为对于一个具体的网络设备而言，其对于数据报接受
+ *	与否的判断根据相关寄存器设置的情况而定，对于多播的支持，一般是对MAC地址位做异或
+ *	之类的计算后通过设置寄存器相关位完成。总之，对于网络接收设备而言，无法直接使用多
+ *	播IP地址，必须将多播IP地址转换为MAC地址后方可为网络设备所使用，从而完成第一道多
+ *	播数据报的过滤防线。ip_mc_filter_add和ip_mc_filter_del函数即完成从相应IP多播地址
+ *	到MAC地址的添加和删除工作。当新添加一个IP多播地址时，需要调用ip_mc_filter_add函
+ *	数将该多播地址转换为MAC地址，并重新设置网络设备硬件寄存器，从而加入对此类多播数
+ *	据报的接收。当删除一个多播地址时，ip_mc_filter_del函数被调用，重新设置网络设备，
+ *	过滤掉对应多播数据报的接收。这两个函数实现上首先调用ip_mc_map函数完成从多播IP地
+ *	址到MAC的映射，然后以此MAC地址调用相关函数对设备本身的多播MAC地址列表进行操作，
+ *	并同时重新设置硬件寄存器（要使新的操作有效，一般还需要从软件上重启网络设备）。此
+ *	处相关函数dev_mc_add, dev_mc_delete函数定义在dev_mcast.c中
+ */
+ 
+void ip_mc_filter_add(struct device *dev, unsigned long addr)
+{
+	char buf[6];
+	if(dev->type!=ARPHRD_ETHER)
+		return;	/* Only do ethernet now */
+	ip_mc_map(addr,buf);	
+	dev_mc_add(dev,buf,ETH_ALEN,0);
+}
+
+/*
+ *	Remove a filter from a device
+ */
+ 
+void ip_mc_filter_del(struct device *dev, unsigned long addr)
+{
+	char buf[6];
+	if(dev->type!=ARPHRD_ETHER)
+		return;	/* Only do ethernet now */
+	ip_mc_map(addr,buf);	
+	dev_mc_delete(dev,buf,ETH_ALEN,0);
+}
+
+
+/*
+ *igmp_group_added和igmp_group_dropped函数即负责多播组地址添加和删除。首先一个新添
+ 加的多播组有ip_mc_list结构表示，对于组添加的情况，我们需要对表示这个组的
+ ip_mc_list结构中相关字段进行初始化，最主要的就是对定时器的初始化工作，
+ igmp_init_timer函数上文中已经介绍，该函数将定时器到期执行函数设置为
+ igmp_timer_expire，igmp_timer_expire函数负责发送一个IGMP报告报文。无论是新添加一
+ 个组，还是退出一个组，此处都立刻发送一个IGMP报告报文，通知路由器相关变化。在前文
+ 对IGMP协议的介绍中，我们提到对于新加入的一个组的情况，我们一般需要发送一个IGMP
+ 报告报文，而对于退出一个组，则无须发送IGMP报告报文，路由器在发送IGMP查询报文后如
+ 果没有收到对应组的报告报文，自然会删除对该IP多播组的维护。但是此处在退出一个组后，
+ 调用了igmp_send_report立刻发送一个IGMP报告报文，这也并非错误。二者都可。
+ 函数最后各自调用ip_mc_filter_del和ip_mc_filter_add函数更改设备MAC多播地址列表反
+ 映新的变化。最后需要提及的是，igmp_group_added和igmp_group_dropped函数实现上虽然
+ 负责加入和退出一个组的工作，但这两个函数并非是在上层加入和退出一个组时，直接被调
+ 用的函数，因为从实现中可以看出这两个函数只涉及到设备维护的MAC地址列表的操作（通
+ 过对ip_mc_filter_del和ip_mc_filter_add函数的调用），但并没有涉及驱动程序和套接字
+ 维护的多播IP地址的操作，所以他们只是作为一个多播组被添加和删除时的一部分实现，换
+ 句话说，还有更上层的函数调用它们
+ * */
+static void igmp_group_dropped(struct ip_mc_list *im)
+{
+	igmp_stop_timer(im);
+	if(igmp_querier(im->interface)==3)
+		igmpv3_send_report(im->interface, im, 1);
+	else
+		igmp_send_report(im, IGMP_HOST_LEAVE_MESSAGE);
+	ip_mc_filter_del(im->interface, im->multiaddr);
+/*	printk("Left group %lX\n",im->multiaddr);*/
+}
+
+/*
+ *	Our filter for a group we stay in has changed. Only an IGMPv3
+ *	querier can be told about sources or filter modes.
+ */
+ 
+static void igmp_group_changed(struct ip_mc_list *im)
+{
+	if(igmp_querier(im->interface)==3)
+		igmpv3_send_report(im->interface, im, 1);
+}
+
+static void igmp_group_added(struct ip_mc_list *im)
+{
+	igmp_init_timer(im);
+	switch(igmp_querier(im->interface))
+	{
+		case 3:
+			igmpv3_send_report(im->interface, im, 1);
+			break;
+		case 2:
+			igmp_send_report(im, IGMP_HOST_NEW_MEMBERSHIP_REPORT);
+			break;
+		default:
+			igmp_send_report(im, IGMP_HOST_MEMBERSHIP_REPORT);
+	}
+	ip_mc_filter_add(im->interface, im->multiaddr);
+/*	printk("Joined group %lX\n",im->multiaddr);*/
+}
+
+int igmp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
+	unsigned long daddr, unsigned short len, unsigned long saddr, int redo,
+	struct inet_protocol *protocol)
+{
+	/* This basically follows the spec line by line -- see RFC1112 */
+	struct igmphdr *igh=(struct igmphdr *)skb->h.raw;
+	
+	/*对TTL字段的检查，对于多播数据报，TTL值必须设置为1*/
+	/* IGMPv3 queries are longer and the checksum covers all of it */
+	if(len<sizeof(*igh) || skb->ip_hdr->ttl!=1 || ip_compute_csum((void *)igh,len))
+	{
+		kfree_skb(skb, FREE_READ);
+		return 0;
+	}
+	
+	if(igh->type==IGMP_HOST_MEMBERSHIP_QUERY && (daddr==IGMP_ALL_HOSTS || daddr==igh->group))
+		igmp_heard_query(dev,igh,len);
+	if((igh->type==IGMP_HOST_MEMBERSHIP_REPORT || igh->type==IGMP_HOST_NEW_MEMBERSHIP_REPORT) && daddr==igh->group)
+		igmp_heard_report(dev,igh->group);
+	kfree_skb(skb, FREE_READ);
+	return 0;
+}
+
+/*
+ *	Multicast list managers
+ */
+ 
+ 
+/*
+ *	A socket has joined a multicast group on device dev.
+ *	们刚刚介绍igmp_group_dropped, igmp_group_added函数并指出这两个函数被更上层的
+ *	函数调用完成多播组的加入和退出工作。“更上层”这个词有些不准确，从前文中涉及内核
+ *	对多播支持的三个方面来看，应该说，igmp_group_dropped, igmp_group_added函数负责了
+ *	网络设备维护的MAC多播地址列表，而驱动程序IP多播地址列表以及套接字对应的多播地址
+ *	列表并未涉及，这就表明还有其他函数负责这些列表的维护。对于驱动程序IP多播地址列表
+ *	的维护即由如下ip_mc_inc_group和ip_mc_dec_group函数负责
+ */
+  
+static void ip_mc_inc_group(struct device *dev, unsigned long addr, int mode, unsigned long *srcs, int nsrc)
+{
+	struct ip_mc_list *i=ip_mc_find(dev,addr);
+	int k;
+	if(i!=NULL)
+	{
+		i->users++;
+		IP_MC_NODE(i)->sfcount[mode]++;
+		for(k=0;k<nsrc;k++)
+			ip_mc_src_add(i,mode,srcs[k]);
+		if(nsrc || (mode==MCAST_EXCLUDE && IP_MC_NODE(i)->sfcount[mode]==1))
+			igmp_group_changed(i);
+		return;
+	}
+	igmp_dev_get(dev);
+	igmp_pool_fill(GFP_KERNEL);
+	i=ip_mc_alloc(dev,addr);
+	if(!i)
+		return;
+	IP_MC_NODE(i)->sfcount[mode]=1;
+	for(k=0;k<nsrc;k++)
+		ip_mc_src_add(i,mode,srcs[k]);
+	igmp_group_added(i);
+	ip_mc_link(i);
+}
+
+/*
+ *	A socket has left a multicast group on device dev
+ */
+	
+static void ip_mc_dec_group(struct device *dev, unsigned long addr, int mode, unsigned long *srcs, int nsrc)
+{
+	struct ip_mc_list *i=ip_mc_find(dev,addr);
+	struct igmp_dev *igd;
+	int k;
+	if(i==NULL)
+		return;
+	for(k=0;k<nsrc;k++)
+		ip_mc_src_del(i,mode,srcs[k]);
+	IP_MC_NODE(i)->sfcount[mode]--;
+	if(--i->users)
+	{
+		if(nsrc || (mode==MCAST_EXCLUDE && IP_MC_NODE(i)->sfcount[mode]==0))
+			igmp_group_changed(i);
+		return;
+	}
+	igmp_group_dropped(i);
+	ip_mc_unlink(i);
+	ip_mc_src_flush(i);
+	igmp_tmpl_free(IP_MC_NODE(i)->tmpl);
+	igd=igmp_dev_find(dev);
+	mc_arena_free(&igd->keys,IP_MC_NODE(i)->key);
+	mc_arena_free(&igd->nodes,IP_MC_NODE(i));
+}
+
+/*
+ *	Device going down: Clean up.
+ *	ip_mc_drop_device函数处理一个网络设备停止工作的情况，此时需要释放用于维护多播地
+ *	址的内存空间，不过这个函数仅仅释放了对应驱动程序的IP多播地址列表，没有释放对应网
+ *	络设备MAC多播地址列表，对此我们可以这样理解：对应套接字的多播地址列表在套接字关
+ *	闭时会自行得到处理，对应网络设备的多播地址列表网络设备本身（即device结构被释放时）
+ *	也会得到处理；对应驱动程序多播地址列表原则上讲这个列表应该完全有驱动程序本身负
+ *	责，对于网络设备应该不可见，为了降低驱动程序复杂性或者是内核对多播处理的一致性，
+ *	这个对应驱动程序的多播地址列表现在放在了device结构中，用个简单的例子就是，一个我
+ *	朋友的不属于我的东西寄存在我这儿，现在我要走了，我自己的东西当然我自己会处理好（我
+ *	自己带走），但这个寄存的朋友的东西我不能带走，在离开之前，我就必须处理掉。此处的
+ *	思想类似如此
+ */
+ 
+void ip_mc_drop_device(struct device *dev)
+{
+	struct ip_mc_list *i;
+	struct ip_mc_list *j;
+	for(i=dev->ip_mc_list;i!=NULL;i=j)
+	{
+		j=i->next;
+		igmp_stop_timer(i);
+		ip_mc_unlink(i);
+		ip_mc_src_flush(i);
+		igmp_tmpl_free(IP_MC_NODE(i)->tmpl);
+	}
+	dev->ip_mc_list=NULL;
+	igmp_dev_drop(dev);	/* Frees the nodes in one go */
+}
+
+/*
+ *	Device going up. Make sure it is in all hosts
+ *	ip_mc_allhost函数在接口启动工作时被调用，用于自动添加全多播组地址（224.0.0.1）。
+ *	IGMP_ALL_HOSTS常量定义为224.0.0.1，注意这个多播组地址不与任何套接字绑定，
+ *	所以此处只对涉及到驱动程序多播地址列表和网络设备多播地址列表，没有套接字多播地址
+ *	列表的操作
+ */
+ 
+void ip_mc_allhost(struct device *dev)
+{
+	struct ip_mc_list *i;
+	if(ip_mc_find(dev,IGMP_ALL_HOSTS)!=NULL)
+		return;
+	igmp_dev_get(dev);
+	igmp_pool_fill(GFP_KERNEL);
+	i=ip_mc_alloc(dev,IGMP_ALL_HOSTS);
+	if(!i)
+		return;
+	IP_MC_NODE(i)->sfcount[MCAST_EXCLUDE]=1;
+	ip_mc_link(i);
+	ip_mc_filter_add(i->interface, i->multiaddr);
+
+}	
+ 
+/*
+ *	Socket memberships. sk->ip_mc_list points at the ip_mc_socklist at
+ *	the front of an ip_mc_sockset; its fixed arrays are no longer used.
+ *	Each membership is an ip_mc_member on the socket's own list and in
+ *	a hash on (socket, device, group), so joins, leaves and duplicate
+ *	checks don't scan and there is no small fixed limit per socket.
+ *	A membership also holds its source filter, kept sorted so delivery
+ *	can binary search it.
+ */
+
+struct ip_mc_member
+{
+	struct ip_mc_member *hash_next;
+	struct ip_mc_member *next;	/* This socket's memberships */
+	struct ip_mc_member **pprev;
+	struct sock *sk;
+	struct device *dev;
+	unsigned long multiaddr;
+	int sfmode;			/* MCAST_INCLUDE or MCAST_EXCLUDE */
+	int nsrc;
+	int srcmax;
+	unsigned long *srcs;		/* Sorted */
+};
+
+struct ip_mc_sockset
+{
+	struct ip_mc_socklist sl;	/* Must be first */
+	struct ip_mc_member *members;
+	int count;
+};
+
+#define IP_MC_SOCKSET(sk)	((struct ip_mc_sockset *)((sk)->ip_mc_list))
+
+#define IP_MC_SOCK_MAX		65536	/* Memberships per socket */
+#define IP_MC_MAX_MSF		256	/* Sources per membership */
+
+static struct ip_mc_member *ip_mc_mhash_min[IP_MC_HASH_MIN];
+static struct ip_mc_member **ip_mc_mhash=ip_mc_mhash_min;
+static unsigned int ip_mc_mhash_size=IP_MC_HASH_MIN;
+static unsigned int ip_mc_mhash_count=0;
+
+static inline unsigned int ip_mc_mhashfn(struct sock *sk, struct device *dev, unsigned long addr, unsigned int size)
+{
+	return ip_mc_hashfn(dev,addr^(unsigned long)sk,size);
+}
+
+static struct ip_mc_member *ip_mc_member_find(struct sock *sk, struct device *dev, unsigned long addr)
+{
+	struct ip_mc_member *m=ip_mc_mhash[ip_mc_mhashfn(sk,dev,addr,ip_mc_mhash_size)];
+	for(;m!=NULL;m=m->hash_next)
+		if(m->multiaddr==addr && m->dev==dev && m->sk==sk)
+			return m;
+	return NULL;
+}
+
+static void ip_mc_mhash_grow(void)
+{
+	struct ip_mc_member **nh, *m, *next;
+	unsigned int size=ip_mc_mhash_size*2;
+	unsigned int i, h;
+	
+	nh=(struct ip_mc_member **)kmalloc(size*sizeof(*nh), GFP_KERNEL);
+	if(nh==NULL)
+		return;
+	memset(nh,0,size*sizeof(*nh));
+	for(i=0;i<ip_mc_mhash_size;i++)
+	{
+		for(m=ip_mc_mhash[i];m!=NULL;m=next)
+		{
+			next=m->hash_next;
+			h=ip_mc_mhashfn(m->sk,m->dev,m->multiaddr,size);
+			m->hash_next=nh[h];
+			nh[h]=m;
+		}
+	}
+	if(ip_mc_mhash!=ip_mc_mhash_min)
+		kfree_s(ip_mc_mhash,ip_mc_mhash_size*sizeof(*ip_mc_mhash));
+	ip_mc_mhash=nh;
+	ip_mc_mhash_size=size;
+}
+
+static void ip_mc_member_link(struct ip_mc_sockset *set, struct ip_mc_member *m)
+{
+	unsigned int h=ip_mc_mhashfn(m->sk,m->dev,m->multiaddr,ip_mc_mhash_size);
+	m->hash_next=ip_mc_mhash[h];
+	ip_mc_mhash[h]=m;
+	ip_mc_mhash_count++;
+	m->next=set->members;
+	if(m->next!=NULL)
+		m->next->pprev=&m->next;
+	m->pprev=&set->members;
+	set->members=m;
+	set->count++;
+}
+
+static void ip_mc_member_unlink(struct ip_mc_sockset *set, struct ip_mc_member *m)
+{
+	struct ip_mc_member **mp;
+	
+	mp=&ip_mc_mhash[ip_mc_mhashfn(m->sk,m->dev,m->multiaddr,ip_mc_mhash_size)];
+	for(;*mp!=NULL;mp=&(*mp)->hash_next)
+	{
+		if(*mp==m)
+		{
+			*mp=m->hash_next;
+			break;
+		}
+	}
+	ip_mc_mhash_count--;
+	*m->pprev=m->next;
+	if(m->next!=NULL)
+		m->next->pprev=m->pprev;
+	set->count--;
+}
+
+/*
+ *	Find a source in a membership's filter. Returns its index, or -1
+ *	with *pos set to where it would go.
+ */
+ 
+static int ip_mc_msrc_find(struct ip_mc_member *m, unsigned long addr, int *pos)
+{
+	int lo=0, hi=m->nsrc;
+	unsigned long key=ntohl(addr);
+	while(lo<hi)
+	{
+		int mid=(lo+hi)/2;
+		unsigned long v=ntohl(m->srcs[mid]);
+		if(v==key)
+			return mid;
+		if(v<key)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	if(pos!=NULL)
+		*pos=lo;
+	return -1;
+}
+
+static int ip_mc_msrc_add(struct ip_mc_member *m, int pos, unsigned long addr)
+{
+	int k;
+	if(m->nsrc>=IP_MC_MAX_MSF)
+		return -ENOBUFS;
+	if(m->nsrc==m->srcmax)
+	{
+		int max=m->srcmax ? m->srcmax*2 : 4;
+		unsigned long *srcs=(unsigned long *)kmalloc(max*sizeof(*srcs), GFP_KERNEL);
+		if(srcs==NULL)
+			return -ENOMEM;
+		if(m->nsrc)
+			memcpy(srcs,m->srcs,m->nsrc*sizeof(*srcs));
+		if(m->srcmax)
+			kfree_s(m->srcs,m->srcmax*sizeof(*m->srcs));
+		m->srcs=srcs;
+		m->srcmax=max;
+	}
+	for(k=m->nsrc;k>pos;k--)
+		m->srcs[k]=m->srcs[k-1];
+	m->srcs[pos]=addr;
+	m->nsrc++;
+	return 0;
+}
+
+static void ip_mc_msrc_del(struct ip_mc_member *m, int idx)
+{
+	m->nsrc--;
+	for(;idx<m->nsrc;idx++)
+		m->srcs[idx]=m->srcs[idx+1];
+}
+
+static void ip_mc_member_free(struct ip_mc_member *m)
+{
+	if(m->srcmax)
+		kfree_s(m->srcs,m->srcmax*sizeof(*m->srcs));
+	kfree_s(m,sizeof(*m));
+}
+
+/*
+ *	Join a socket to a group
+ *	如前文所述，驱动程序使用ip_mc_list结构表示IP多播地址，ip_mc_inc_group和
+ *	ip_mc_dec_group函数即完成对一个表示新多播地址对应的ip_mc_list结构的创建工作，当
+ *	然首先我们必须检查当前地址列表中是否已经有这样一个相同的组地址存在，如果存在，则
+ *	简单增加用户使用计数即可。因为驱动程序在这方面如同路由器一样，并不关心究竟有多少
+ *	上层套接字加入了这个多播组，维护用户计数的首要目的是防止该ip_mc_list结构被提前释
+ *	放，从而造成非法内存访问之类的系统错误。驱动程序维护的多播地址列表有device结构
+ *	ip_mc_list字段指向，如果当前没有对应的多播地址，则创建一个新的ip_mc_list结构，并
+ *	加入到由device结构ip_mc_list字段(注意此处不要混淆，device结构中对驱动程序维护的
+ *	IP地址列表的指针名称正好与表示一个多播地址的结构名称相同)指向的地址列表中,为了
+ *	增加软件处理效率，这个新的ip_mc_list结构被加入到列表的首部。在完成对应驱动程序的
+ *	IP多播地址列表的操作后，各自调用igmp_group_added和igmp_group_dropped函数完成对应
+ *	设备的MAC多播地址列表的操作。那么对于一个多播（组）地址的加入和退出现在只剩下对
+ *	应套接字多播地址列表的操作了，这个操作定义在ip_mc_join_group和ip_mc_leave_group
+ *	函数中
+ */
+ 
+static int ip_mc_join(struct sock *sk , struct device *dev, unsigned long addr, int mode, unsigned long *src)
+{
+	struct ip_mc_sockset *set;
+	struct ip_mc_member *m;
+	
+	if(!MULTICAST(addr))
+		return -EINVAL;
+	if(!(dev->flags&IFF_MULTICAST))
+		return -EADDRNOTAVAIL;
+	if(sk->ip_mc_list==NULL)
+	{
+		if((set=(struct ip_mc_sockset *)kmalloc(sizeof(*set), GFP_KERNEL))==NULL)
+			return -ENOMEM;
+		memset(set,'\0',sizeof(*set));
+		sk->ip_mc_list=&set->sl;
+	}
+	set=IP_MC_SOCKSET(sk);
+	if(ip_mc_member_find(sk,dev,addr)!=NULL)
+		return -EADDRINUSE;
+	if(set->count>=IP_MC_SOCK_MAX)
+		return -ENOBUFS;
+	if(ip_mc_mhash_count>=ip_mc_mhash_size && ip_mc_mhash_size<IP_MC_HASH_MAX)
+		ip_mc_mhash_grow();
+	if((m=(struct ip_mc_member *)kmalloc(sizeof(*m), GFP_KERNEL))==NULL)
+		return -ENOMEM;
+	m->sk=sk;
+	m->dev=dev;
+	m->multiaddr=addr;
+	m->sfmode=mode;
+	m->nsrc=0;
+	m->srcmax=0;
+	m->srcs=NULL;
+	if(src!=NULL && ip_mc_msrc_add(m,0,*src)<0)
+	{
+		kfree_s(m,sizeof(*m));
+		return -ENOMEM;
+	}
+	/* Someone else may have got in while we slept */
+	if(ip_mc_member_find(sk,dev,addr)!=NULL)
+	{
+		ip_mc_member_free(m);
+		return -EADDRINUSE;
+	}
+	ip_mc_member_link(set,m);
+	ip_mc_inc_group(dev,addr,mode,m->srcs,m->nsrc);
+	return 0;
+}
+
+int ip_mc_join_group(struct sock *sk , struct device *dev, unsigned long addr)
+{
+	return ip_mc_join(sk,dev,addr,MCAST_EXCLUDE,NULL);
+}
+
+/*
+ *	Ask a socket to leave a group.
+ */
+ 
+int ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr)
+{
+	struct ip_mc_member *m;
+	if(!MULTICAST(addr))
+		return -EINVAL;
+	if(!(dev->flags&IFF_MULTICAST))
+		return -EADDRNOTAVAIL;
+	if(sk->ip_mc_list==NULL)
+		return -EADDRNOTAVAIL;
+	
+	m=ip_mc_member_find(sk,dev,addr);
+	if(m==NULL)
+		return -EADDRNOTAVAIL;
+	ip_mc_member_unlink(IP_MC_SOCKSET(sk),m);
+	ip_mc_dec_group(dev,addr,m->sfmode,m->srcs,m->nsrc);
+	ip_mc_member_free(m);
+	return 0;
+}
+
+/*
+ *	Add or remove one source in a socket's filter for a group. omode
+ *	says which kind of filter the caller means: MCAST_INCLUDE for
+ *	IP_ADD_SOURCE_MEMBERSHIP/IP_DROP_SOURCE_MEMBERSHIP, MCAST_EXCLUDE
+ *	for IP_BLOCK_SOURCE/IP_UNBLOCK_SOURCE. The first included source
+ *	joins the group and dropping the last one leaves it.
+ */
+ 
+int ip_mc_source(struct sock *sk, struct device *dev, unsigned long addr, unsigned long source, int add, int omode)
+{
+	struct ip_mc_member *m=NULL;
+	struct ip_mc_list *im;
+	int idx, pos, err;
+	
+	if(!MULTICAST(addr))
+		return -EINVAL;
+	if(!(dev->flags&IFF_MULTICAST))
+		return -EADDRNOTAVAIL;
+	if(sk->ip_mc_list!=NULL)
+		m=ip_mc_member_find(sk,dev,addr);
+	if(m==NULL)
+	{
+		if(add && omode==MCAST_INCLUDE)
+			return ip_mc_join(sk,dev,addr,MCAST_INCLUDE,&source);
+		return -EADDRNOTAVAIL;
+	}
+	if(m->sfmode!=omode)
+		return -EINVAL;
+	idx=ip_mc_msrc_find(m,source,&pos);
+	im=ip_mc_find(dev,addr);
+	if(add)
+	{
+		if(idx>=0)
+			return 0;
+		if((err=ip_mc_msrc_add(m,pos,source))<0)
+			return err;
+		if(im!=NULL)
+		{
+			ip_mc_src_add(im,omode,source);
+			igmp_group_changed(im);
+		}
+		return 0;
+	}
+	if(idx<0)
+		return -EADDRNOTAVAIL;
+	if(omode==MCAST_INCLUDE && m->nsrc==1)
+		return ip_mc_leave_group(sk,dev,addr);
+	ip_mc_msrc_del(m,idx);
+	if(im!=NULL)
+	{
+		ip_mc_src_del(im,omode,source);
+		igmp_group_changed(im);
+	}
+	return 0;
+}
+
+/*
+ *	Receive side checks. ip_mc_source_ok says whether the interface
+ *	filter for a group passes a source at all, ip_mc_sf_allow whether a
+ *	given socket wants it. A socket that isn't a member of the group
+ *	gets what it always got.
+ */
+ 
+int ip_mc_source_ok(struct device *dev, unsigned long addr, unsigned long saddr)
+{
+	struct ip_mc_list *im=ip_mc_find(dev,addr);
+	struct ip_mc_src *ps;
+	
+	if(im==NULL)
+		return 0;
+	ps=ip_mc_src_find(im,saddr);
+	if(IP_MC_NODE(im)->sfcount[MCAST_EXCLUDE])
+		return ps==NULL || !ip_mc_src_listed(im,ps);
+	return ps!=NULL && ip_mc_src_listed(im,ps);
+}
+
+int ip_mc_sf_allow(struct sock *sk, struct device *dev, unsigned long addr, unsigned long saddr)
+{
+	struct ip_mc_member *m;
+	int found;
+	
+	if(sk->ip_mc_list==NULL || (m=ip_mc_member_find(sk,dev,addr))==NULL)
+		return 1;
+	found=(ip_mc_msrc_find(m,saddr,NULL)>=0);
+	return (m->sfmode==MCAST_INCLUDE) ? found : !found;
+}
+
+/*
+ *	A socket is closing.
+ *	ip_mc_drop_socket函数处理一个使用多播的套接字被关闭时对多播地址列表的处理。492
+ *	行检查该套接字是否使用了多播，如果没有，则直接返回。否则遍历套接字对应多播地址列
+ *	表，对每个多播地址对应的各层结构进行释放
+ */
+ 
+void ip_mc_drop_socket(struct sock *sk)
+{
+	struct ip_mc_sockset *set;
+	struct ip_mc_member *m;
+	
+	if(sk->ip_mc_list==NULL)
+		return;
+	
+	set=IP_MC_SOCKSET(sk);
+	while((m=set->members)!=NULL)
+	{
+		ip_mc_member_unlink(set,m);
+		ip_mc_dec_group(m->dev, m->multiaddr, m->sfmode, m->srcs, m->nsrc);
+		ip_mc_member_free(m);
+	}
+	kfree_s(set,sizeof(*set));
+	sk->ip_mc_list=NULL;
+}
+
+/*
+ *	Report delay and suppression counters for /proc.
+ */
+ 
+int igmp_get_info(char *buffer, char **start, off_t offset, int length, int dummy)
+{
+	int len, i;
+	
+	len=sprintf(buffer,"Queries  Reports  Suppressed  Duplicates\n%7lu %8lu %11lu %11lu\nDelays  ",
+		igmp_stats.queries, igmp_stats.reports, igmp_stats.suppressed,
+		igmp_stats.duplicates);
+	for(i=0;i<IGMP_DELAY_BUCKETS;i++)
+		len+=sprintf(buffer+len," %lu",igmp_stats.delays[i]);
+	len+=sprintf(buffer+len,"\nPool %lu hits %lu misses %lu drops\n",
+		igmp_stats.pool_hits, igmp_stats.pool_misses, igmp_stats.pool_drops);
+	*start=buffer+offset;
+	len-=offset;
+	if(len>length)
+		len=length;
+	if(len<0)
+		len=0;
+	return len;
+}
+
+#endif
@@ -1,85 +1,764 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/net_tstamp.h>
+#include "igmp_test.h"
+#include "igmp_uring.h"
 
 #define   MUL_ADDR  "224.0.0.100"
 #define   MUL_PORT  8888
 #define   WAIT_TIME 5
 
+#define   MAX_BATCH  1024
+#define   SLOT_SIZE  2048	/* Room for one datagram in the ring */
+#define   MAX_THREADS 256
+#define   SEQ_RESTART 65536	/* A sequence this far back is a new sender */
+#define   CTRL_SIZE  (CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(3 * sizeof(struct timespec)))
 
-int main(int argc, char **argv)
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+/*
+ * Latency histogram, log-linear like HdrHistogram: values below 2^SUB_BITS
+ * get a bucket each, above that every power of two is split into 2^SUB_BITS
+ * buckets, so any value is known to within about 3%.
+ */
+#define   SUB_BITS   5
+#define   SUB        (1 << SUB_BITS)
+#define   HIST_SIZE  ((64 - SUB_BITS + 1) * SUB)
+
+struct hist
+{
+	unsigned long long count;
+	unsigned long long max;
+	unsigned long long counts[HIST_SIZE];
+};
+
+static int hist_index(unsigned long long v)
+{
+	int e;
+
+	if (v < SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return (e - SUB_BITS + 1) * SUB + (int)((v >> (e - SUB_BITS)) - SUB);
+}
+
+/* Largest value that lands in bucket i */
+static unsigned long long hist_value(int i)
+{
+	int e;
+
+	if (i < SUB)
+		return i;
+	e = i / SUB + SUB_BITS - 1;
+	return ((unsigned long long)(i % SUB + SUB + 1) << (e - SUB_BITS)) - 1;
+}
+
+static void hist_add(struct hist *h, unsigned long long v)
+{
+	h->counts[hist_index(v)]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+static unsigned long long hist_quantile(struct hist *h, double q)
+{
+	unsigned long long want = (unsigned long long)(q * h->count), seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_SIZE; i++)
+	{
+		seen += h->counts[i];
+		if (seen > want)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+static void hist_merge(struct hist *to, struct hist *from)
+{
+	int i;
+
+	for (i = 0; i < HIST_SIZE; i++)
+		to->counts[i] += from->counts[i];
+	to->count += from->count;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+static void hist_print(const char *tag, struct hist *h)
+{
+	if (h->count == 0)
+		return;
+	fprintf(stderr, "  %s latency us: p50 %.1f p99 %.1f p99.9 %.1f max %.1f (%llu samples)\n",
+		tag, hist_quantile(h, 0.5) / 1e3, hist_quantile(h, 0.99) / 1e3,
+		hist_quantile(h, 0.999) / 1e3, h->max / 1e3, h->count);
+}
+
+/*
+ * Receiver mode. Any option selects it; with none we read five
+ * messages and leave as before.
+ */
+struct opts
 {
+	const char *groups;
+	int ngroups;		/* -N: extend the list to this many */
+	int port;
+	const char *ifaddr;
+	int batch;		/* datagrams per recvmmsg */
+	int ring;		/* buffer slots, a multiple of batch */
+	int busy_poll;		/* SO_BUSY_POLL microseconds, 0 for off */
+	int rcvbuf;		/* SO_RCVBUF bytes, 0 to leave alone */
+	int duration;		/* seconds to run, 0 for until interrupted */
+	int tstamp;		/* use kernel receive timestamps as well */
+	int threads;		/* receive threads */
+	int cpus[MAX_THREADS];	/* to pin them to, in turn */
+	int ncpus;
+	int reuseport;		/* all threads join all groups */
+	int uring;		/* -U: multishot recvmsg on io_uring */
+};
+
+struct stats
+{
+	unsigned long long packets;
+	unsigned long long bytes;
+	unsigned long long lost;	/* gaps in the sequence numbers */
+	unsigned long long late;	/* behind the sequence, reordered or duplicated */
+	unsigned long long bad;		/* not one of our test packets */
+	unsigned long long restarts;	/* sequence started again */
+	unsigned int kdrops;		/* socket drops reported by the kernel */
+};
+
+/*
+ * Latency from the sender's stamp to the kernel taking the packet (krx,
+ * 0 without -T) and to us reading it (urx). Clocks a little apart on
+ * different hosts can make it negative; that counts as zero.
+ */
+struct lat
+{
+	struct hist app;	/* sender to us */
+	struct hist kernel;	/* sender to the kernel receive stamp */
+};
+
+/*
+ * One receive thread with its own socket. The counters and the latency
+ * of the current second belong to the thread; now and then it copies
+ * them under the lock for the main thread to report.
+ */
+struct worker
+{
+	pthread_t thread;
+	int id;
+	int cpu;		/* -1 for no pinning */
 	int s;
-	struct sockaddr_in caddr;
+	struct in_addr grp[MAX_GROUPS];	/* groups this thread joins */
+	int ngrp;
+	uint64_t next_seq[MAX_GROUPS];	/* 0 until the group's first packet */
+	struct stats st;
+	struct lat tick;
+	pthread_mutex_t lock;
+	struct stats pub;	/* st as of the last hand over */
+	struct lat done;	/* latency handed over, cleared by the reader */
+};
+
+static struct opts o;
+static struct in_addr grp[MAX_GROUPS];
+static int ngrp;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-g group[,group...]] [-N groups] [-p port] [-I ifaddr]\n"
+		"          [-b batch] [-R ring] [-B busy_poll_us] [-r rcvbuf] [-d seconds] [-T]\n"
+		"          [-w threads] [-c cpu[,cpu...]] [-P] [-U]\n"
+		"  -g  groups to join (default %s)\n"
+		"  -N  extend the group list to this many consecutive groups\n"
+		"  -b  datagrams per recvmmsg call (default 64, at most %d)\n"
+		"  -R  datagram slots in the receive ring (default 1024)\n"
+		"  -B  SO_BUSY_POLL time in microseconds\n"
+		"  -r  SO_RCVBUF size in bytes\n"
+		"  -d  stop after this many seconds\n"
+		"  -T  also take kernel receive timestamps (SO_TIMESTAMPING)\n"
+		"  -w  receive threads, each with its own socket (default 1)\n"
+		"  -c  CPUs to pin the threads to, in turn\n"
+		"  -P  every thread joins every group on a SO_REUSEPORT socket instead\n"
+		"      of the groups being dealt out; the kernel hands each thread its\n"
+		"      own copy of every datagram, which tests fan-out to N consumers\n"
+		"  -U  receive with io_uring multishot recvmsg into a provided buffer\n"
+		"      ring of -R buffers (a power of two) instead of recvmmsg\n",
+		prog, MUL_ADDR, MAX_BATCH);
+	exit(-1);
+}
+
+static void legacy(int s)
+{
+	int times;
+	int recvlen;
+	char recvbuff[64];
+	for (times = 0; times < 5; times++)
+	{
+		memset(recvbuff, 0, sizeof(recvbuff));
+
+		recvlen = recvfrom(s, recvbuff, sizeof(recvbuff), 0, NULL, 0);
+		if (recvlen < 0)
+		{
+			perror("recvfrom error");
+			exit(-1);
+		}
+
+		printf("recv from server message: %s\n", recvbuff);
+	}
+}
+
+static void join_groups(int s, struct in_addr *g, int n, int opt)
+{
 	struct ip_mreq mreq;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		mreq.imr_multiaddr = g[i];
+		mreq.imr_interface.s_addr = o.ifaddr ? inet_addr(o.ifaddr) : htonl(INADDR_ANY);
+		if ((setsockopt(s, IPPROTO_IP, opt, &mreq, sizeof(mreq))) < 0)
+		{
+			perror("setsockopt error");
+			exit(-1);
+		}
+	}
+}
+
+/*
+ * Bind the port and join the groups on a new socket. Several of ours
+ * may share the port; IP_MULTICAST_ALL off keeps each to the groups it
+ * joined itself.
+ */
+static int open_socket(struct in_addr *g, int n)
+{
+	int s, one = 1, zero = 0;
+	struct sockaddr_in caddr;
 
 	if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
 	{
 		perror("socket error");
 		exit(-1);
 	}
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	setsockopt(s, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof(zero));
+	setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+	if (o.rcvbuf)
+	{
+		/* FORCE gets past rmem_max when we are allowed to */
+		if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &o.rcvbuf, sizeof(o.rcvbuf)) < 0 &&
+		    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &o.rcvbuf, sizeof(o.rcvbuf)) < 0)
+			perror("setsockopt SO_RCVBUF");
+	}
+	if (o.busy_poll && setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &o.busy_poll, sizeof(o.busy_poll)) < 0)
+		perror("setsockopt SO_BUSY_POLL");
+	if (o.tstamp)
+	{
+		int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+		if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+			perror("setsockopt SO_TIMESTAMPING");
+	}
 
 	memset(&caddr, 0, sizeof(caddr));
 	caddr.sin_family = AF_INET;
 	caddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	caddr.sin_port = htons(MUL_PORT);
-
+	caddr.sin_port = htons(o.port);
 	if ((bind(s, (struct sockaddr*)&caddr, sizeof(caddr))) == -1)
 	{
 		perror("bind error");
 		exit(-1);
 	}
 
-	unsigned char ttl=255;
-	setsockopt(s,IPPROTO_IP,IP_MULTICAST_TTL,&ttl,sizeof(ttl));
+	join_groups(s, g, n, IP_ADD_MEMBERSHIP);
+	return s;
+}
 
-    /*设置回环许可*/
-/*	    int loop = 1;
+static void record(struct hist *h, uint64_t tx, uint64_t rx)
+{
+	hist_add(h, rx > tx ? rx - tx : 0);
+}
 
-	   int	err = setsockopt(s,IPPROTO_IP, IP_MULTICAST_LOOP,&loop, sizeof(loop));
-		if(err < 0)
+/*
+ * Account for one datagram, read in place from its ring slot.
+ */
+static void account(struct worker *w, const char *p, int len, uint64_t krx, uint64_t urx)
+{
+	const struct test_hdr *h = (const struct test_hdr *)p;
+	struct stats *st = &w->st;
+
+	st->packets++;
+	st->bytes += len;
+	if (len < (int)sizeof(*h) || h->magic != TEST_MAGIC || h->group >= MAX_GROUPS)
+	{
+		st->bad++;
+		return;
+	}
+	/*
+	 * Count from the first packet heard, wherever the sender is, and
+	 * again from wherever it starts over.
+	 */
+	if (w->next_seq[h->group] == 0 || h->seq + SEQ_RESTART < w->next_seq[h->group])
+	{
+		if (w->next_seq[h->group] != 0)
+			st->restarts++;
+		w->next_seq[h->group] = h->seq + 1;
+	}
+	else if (h->seq >= w->next_seq[h->group])
+	{
+		st->lost += h->seq - w->next_seq[h->group];
+		w->next_seq[h->group] = h->seq + 1;
+	}
+	else
+		st->late++;
+	record(&w->tick.app, h->tx_ns, urx);
+	if (krx)
+		record(&w->tick.kernel, h->tx_ns, krx);
+}
+
+/*
+ * Pick the drop counter and kernel timestamp out of a message's
+ * control data. Returns the timestamp, 0 if there was none.
+ */
+static uint64_t parse_cmsg(struct worker *w, struct msghdr *mh)
+{
+	struct cmsghdr *cm;
+	uint64_t krx = 0;
+
+	for (cm = CMSG_FIRSTHDR(mh); cm != NULL; cm = CMSG_NXTHDR(mh, cm))
+	{
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cm->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&w->st.kdrops, CMSG_DATA(cm), sizeof(w->st.kdrops));
+		else if (cm->cmsg_type == SCM_TIMESTAMPING)
 		{
-			perror("setsockopt():IP_MULTICAST_LOOP");
-			return -3;
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+			krx = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 		}
+	}
+	return krx;
+}
 
-*/
-	mreq.imr_multiaddr.s_addr = inet_addr(MUL_ADDR);
-	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
-	if ((setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) < 0) 
+static void hand_over(struct worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->pub = w->st;
+	hist_merge(&w->done.app, &w->tick.app);
+	hist_merge(&w->done.kernel, &w->tick.kernel);
+	pthread_mutex_unlock(&w->lock);
+	memset(&w->tick, 0, sizeof(w->tick));
+}
+
+static void recv_loop(struct worker *w)
+{
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	static __thread char ctrl[MAX_BATCH][CTRL_SIZE];
+	struct timeval tv = { 0, 100000 };
+	char *ring;
+	int head = 0, i, r;
+	uint64_t last, now;
+
+	ring = malloc((size_t)o.ring * SLOT_SIZE);
+	if (ring == NULL)
 	{
-		perror("setsockopt error");
+		perror("malloc");
 		exit(-1);
 	}
-	
-	int times;
-	int recvlen;
-	char recvbuff[64];
-	for (times = 0; times < 5; times++)
+	/* Wake up now and then so stats and -d work on an idle feed */
+	setsockopt(w->s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	last = now_ns();
+	while (!stop)
 	{
-		memset(recvbuff, 0, sizeof(recvbuff));
+		/* Point the batch at the next run of free slots */
+		for (i = 0; i < o.batch; i++)
+		{
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			iov[i].iov_base = ring + (size_t)(head + i) * SLOT_SIZE;
+			iov[i].iov_len = SLOT_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+		}
+		r = recvmmsg(w->s, msgs, o.batch, MSG_WAITFORONE, NULL);
+		if (r < 0 && errno != EAGAIN && errno != EINTR)
+		{
+			perror("recvmmsg error");
+			exit(-1);
+		}
+		now = now_ns();
+		for (i = 0; i < r; i++)
+			account(w, iov[i].iov_base, msgs[i].msg_len, parse_cmsg(w, &msgs[i].msg_hdr), now);
+		if (r > 0)
+			head = (head + o.batch) % o.ring;
+		if (now - last >= 100000000ULL)
+		{
+			hand_over(w);
+			last = now;
+		}
+	}
+	hand_over(w);
+	free(ring);
+}
 
-		recvlen = recvfrom(s, recvbuff, sizeof(recvbuff), 0, NULL, 0);
-		if (recvlen < 0)
+/*
+ * The io_uring flavour of recv_loop. One multishot recvmsg stays armed on
+ * the socket and the kernel completes it once per datagram, into a buffer
+ * it takes from our provided ring: a struct io_uring_recvmsg_out, the
+ * control data, then the payload. Buffers go back to the ring once read.
+ * The request ends when the ring runs dry or on an error, and is armed
+ * again then.
+ */
+static void uring_recv_loop(struct worker *w)
+{
+	struct uring ring;
+	struct uring_bufs bufs;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct msghdr tmpl;
+	uint64_t last, now;
+	int armed = 0;
+
+	if (uring_init(&ring, 8, o.ring * 2) < 0 ||
+	    uring_bufs_init(&ring, &bufs, 0, o.ring, sizeof(struct io_uring_recvmsg_out) + CTRL_SIZE + SLOT_SIZE) < 0)
+	{
+		perror("io_uring setup");
+		exit(-1);
+	}
+	/* Only the sizes count: no name, room for our control data */
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.msg_controllen = CTRL_SIZE;
+
+	last = now_ns();
+	while (!stop)
+	{
+		/* On a full queue, submit what is there and arm next time round */
+		if (!armed && (sqe = uring_sqe(&ring)) != NULL)
 		{
-			perror("recvfrom error");
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->fd = w->s;
+			sqe->addr = (uint64_t)(uintptr_t)&tmpl;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = bufs.bgid;
+			armed = 1;
+		}
+		/* Wake up now and then so stats and -d work on an idle feed */
+		if (uring_submit(&ring, 1, 100000000ULL) < 0 && errno != ETIME && errno != EINTR)
+		{
+			perror("io_uring_enter");
 			exit(-1);
 		}
-		
-		printf("recv from server message: %s\n", recvbuff);
+		now = now_ns();
+		while ((cqe = uring_cqe(&ring)) != NULL)
+		{
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				armed = 0;
+			if (cqe->res < 0)
+			{
+				if (cqe->res != -ENOBUFS)
+				{
+					errno = -cqe->res;
+					perror("io_uring recvmsg error");
+					exit(-1);
+				}
+			}
+			else if (cqe->flags & IORING_CQE_F_BUFFER)
+			{
+				unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				char *p = bufs.base + (size_t)bid * bufs.size;
+				struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)p;
+				struct msghdr mh;
+				unsigned len = out->payloadlen;
+
+				memset(&mh, 0, sizeof(mh));
+				mh.msg_control = p + sizeof(*out) + tmpl.msg_namelen;
+				mh.msg_controllen = out->controllen;
+				if (len > SLOT_SIZE)
+					len = SLOT_SIZE;
+				account(w, (char *)mh.msg_control + tmpl.msg_controllen, len, parse_cmsg(w, &mh), now);
+				uring_buf_put(&bufs, bid);
+			}
+			uring_cqe_seen(&ring);
+		}
+		uring_buf_publish(&bufs);
+		if (now - last >= 100000000ULL)
+		{
+			hand_over(w);
+			last = now;
+		}
+	}
+	hand_over(w);
+	uring_exit(&ring);
+	uring_bufs_free(&bufs);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+
+	if (w->cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			fprintf(stderr, "thread %d: cannot pin to cpu %d\n", w->id, w->cpu);
+	}
+	if (o.uring)
+		uring_recv_loop(w);
+	else
+		recv_loop(w);
+	return NULL;
+}
+
+static void print_stats(const char *tag, struct stats *now, struct stats *prev, double secs)
+{
+	fprintf(stderr, "%s %.0f pps %.1f Mbit/s, lost %llu, late %llu, bad %llu, restarts %llu, kernel drops %u\n",
+		tag, (now->packets - prev->packets) / secs,
+		(now->bytes - prev->bytes) * 8.0 / secs / 1e6,
+		now->lost - prev->lost, now->late - prev->late,
+		now->bad - prev->bad, now->restarts - prev->restarts,
+		now->kdrops - prev->kdrops);
+}
+
+static void print_lat(struct lat *lat)
+{
+	hist_print("app", &lat->app);
+	hist_print("kernel", &lat->kernel);
+}
+
+static void add_stats(struct stats *to, struct stats *from)
+{
+	to->packets += from->packets;
+	to->bytes += from->bytes;
+	to->lost += from->lost;
+	to->late += from->late;
+	to->bad += from->bad;
+	to->restarts += from->restarts;
+	to->kdrops += from->kdrops;
+}
+
+/*
+ * Once a second: each thread's share and the whole, then the latency
+ * of all threads together.
+ */
+static void report(struct worker *ws, int nw, struct stats *prev, struct stats *sum_prev,
+	struct lat *tick, struct lat *total, double secs, int final)
+{
+	struct stats sum;
+	int i;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < nw; i++)
+	{
+		struct stats cur;
+		char tag[32];
+
+		pthread_mutex_lock(&ws[i].lock);
+		cur = ws[i].pub;
+		hist_merge(&tick->app, &ws[i].done.app);
+		hist_merge(&tick->kernel, &ws[i].done.kernel);
+		memset(&ws[i].done, 0, sizeof(ws[i].done));
+		pthread_mutex_unlock(&ws[i].lock);
+		if (nw > 1)
+		{
+			snprintf(tag, sizeof(tag), "  thread %d cpu %d", i, ws[i].cpu);
+			print_stats(tag, &cur, &prev[i], secs);
+		}
+		add_stats(&sum, &cur);
+		if (!final)
+			prev[i] = cur;
 	}
+	print_stats(final ? "total" : "rx", &sum, sum_prev, secs);
+	*sum_prev = sum;
+	hist_merge(&total->app, &tick->app);
+	hist_merge(&total->kernel, &tick->kernel);
+	print_lat(final ? total : tick);
+	memset(tick, 0, sizeof(*tick));
+}
+
+static void run(void)
+{
+	static struct lat tick, total;
+	struct worker *ws;
+	struct stats *prev, sum_prev;
+	uint64_t start, last, now;
+	int i;
 
-	if ((setsockopt(s, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq))) < 0) 
+	ws = calloc(o.threads, sizeof(*ws));
+	prev = calloc(o.threads, sizeof(*prev));
+	if (ws == NULL || prev == NULL)
 	{
-		perror("setsockopt error");
+		perror("calloc");
 		exit(-1);
 	}
+	for (i = 0; i < o.threads; i++)
+	{
+		struct worker *w = &ws[i];
+		int g;
+
+		w->id = i;
+		w->cpu = o.ncpus ? o.cpus[i % o.ncpus] : -1;
+		pthread_mutex_init(&w->lock, NULL);
+		/* Deal the groups out in turn, or give everyone all of them */
+		for (g = o.reuseport ? 0 : i; g < ngrp; g += o.reuseport ? 1 : o.threads)
+			w->grp[w->ngrp++] = grp[g];
+		if (w->ngrp == 0)
+		{
+			fprintf(stderr, "more threads than groups\n");
+			exit(-1);
+		}
+		w->s = open_socket(w->grp, w->ngrp);
+	}
+	for (i = 0; i < o.threads; i++)
+	{
+		if (pthread_create(&ws[i].thread, NULL, worker_main, &ws[i]) != 0)
+		{
+			perror("pthread_create");
+			exit(-1);
+		}
+	}
+
+	memset(&sum_prev, 0, sizeof(sum_prev));
+	start = last = now_ns();
+	while (!stop)
+	{
+		struct timespec ts = { 0, 50000000 };
+
+		nanosleep(&ts, NULL);
+		now = now_ns();
+		if (now - last >= 1000000000ULL)
+		{
+			report(ws, o.threads, prev, &sum_prev, &tick, &total, (now - last) / 1e9, 0);
+			last = now;
+		}
+		if (o.duration && now - start >= o.duration * 1000000000ULL)
+			stop = 1;
+	}
+	for (i = 0; i < o.threads; i++)
+		pthread_join(ws[i].thread, NULL);
+
+	memset(prev, 0, o.threads * sizeof(*prev));
+	memset(&sum_prev, 0, sizeof(sum_prev));
+	report(ws, o.threads, prev, &sum_prev, &tick, &total, (now_ns() - start) / 1e9, 1);
+	for (i = 0; i < o.threads; i++)
+	{
+		join_groups(ws[i].s, ws[i].grp, ws[i].ngrp, IP_DROP_MEMBERSHIP);
+		close(ws[i].s);
+	}
+	free(prev);
+	free(ws);
+}
+
+/* "0,2,4" into o.cpus */
+static void parse_cpus(const char *spec)
+{
+	char *copy = strdup(spec), *p, *save = NULL;
+
+	for (p = strtok_r(copy, ",", &save); p != NULL && o.ncpus < MAX_THREADS; p = strtok_r(NULL, ",", &save))
+		o.cpus[o.ncpus++] = atoi(p);
+	free(copy);
+}
+
+int main(int argc, char **argv)
+{
+	int s, c;
+
+	memset(&o, 0, sizeof(o));
+	o.groups = MUL_ADDR;
+	o.port = MUL_PORT;
+	o.batch = 64;
+	o.ring = 1024;
+	o.threads = 1;
+	while ((c = getopt(argc, argv, "g:N:p:I:b:R:B:r:d:Tw:c:PUh")) != -1)
+	{
+		switch (c)
+		{
+		case 'g': o.groups = optarg; break;
+		case 'N': o.ngroups = atoi(optarg); break;
+		case 'p': o.port = atoi(optarg); break;
+		case 'I': o.ifaddr = optarg; break;
+		case 'b': o.batch = atoi(optarg); break;
+		case 'R': o.ring = atoi(optarg); break;
+		case 'B': o.busy_poll = atoi(optarg); break;
+		case 'r': o.rcvbuf = atoi(optarg); break;
+		case 'd': o.duration = atoi(optarg); break;
+		case 'T': o.tstamp = 1; break;
+		case 'w': o.threads = atoi(optarg); break;
+		case 'c': parse_cpus(optarg); break;
+		case 'P': o.reuseport = 1; break;
+		case 'U': o.uring = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	ngrp = parse_groups(o.groups, o.ngroups, grp, MAX_GROUPS);
+	if (ngrp <= 0)
+	{
+		fprintf(stderr, "bad group list %s\n", o.groups);
+		exit(-1);
+	}
+	if (o.batch < 1 || o.batch > MAX_BATCH || o.ring < o.batch || o.ring % o.batch ||
+	    o.threads < 1 || o.threads > MAX_THREADS ||
+	    (o.uring && ((o.ring & (o.ring - 1)) || o.ring > 32768)))
+		usage(argv[0]);
+
+	if (argc > 1)
+	{
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+		run();
+		return 0;
+	}
+
+	s = open_socket(grp, ngrp);
+
+	unsigned char ttl=255;
+	setsockopt(s,IPPROTO_IP,IP_MULTICAST_TTL,&ttl,sizeof(ttl));
+
+    /*设置回环许可*/
+/*	    int loop = 1;
+
+	   int	err = setsockopt(s,IPPROTO_IP, IP_MULTICAST_LOOP,&loop, sizeof(loop));
+		if(err < 0)
+		{
+			perror("setsockopt():IP_MULTICAST_LOOP");
+			return -3;
+		}
+
+*/
+	legacy(s);
+
+	join_groups(s, grp, ngrp, IP_DROP_MEMBERSHIP);
 
 	close(s);
 	return 0;
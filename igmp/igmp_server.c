@@ -1,22 +1,294 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include "igmp_test.h"
+#include "igmp_uring.h"
 
 #define   MUL_ADDR  "224.0.0.100"
 #define   MUL_PORT   8888
 #define   WAIT_TIME 5
 
+#define   MAX_BATCH  1024
+#define   MAX_SEGS   64		/* UDP GSO allows 64 segments per send */
+#define   MAX_DGRAM  65507
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
 const char buf[64] = "this is test";
+
+/*
+ * Throughput mode. Any option selects it; with none we send the old
+ * test string every WAIT_TIME seconds.
+ */
+struct opts {
+	const char *groups;
+	int ngroups;		/* -N: extend the list to this many */
+	int port;
+	long rate;		/* packets per second, 0 for as fast as we can */
+	int size;		/* payload bytes per packet */
+	int batch;		/* messages per sendmmsg */
+	int segs;		/* UDP GSO segments per message, 1 for none */
+	long long count;	/* stop after this many packets, 0 for never */
+	const char *ifaddr;
+	int ttl;
+	int uring;		/* -U: submit through io_uring instead of sendmmsg */
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-g group[,group...]] [-N groups] [-p port] [-r pps] [-s size]\n"
+		"          [-b batch] [-G segs] [-n count] [-I ifaddr] [-t ttl] [-U]\n"
+		"  -g  groups to send to (default %s)\n"
+		"  -N  extend the group list to this many consecutive groups\n"
+		"  -r  packets per second, 0 for unlimited (default 0)\n"
+		"  -s  payload bytes per packet (default 64, at least %d)\n"
+		"  -b  messages per sendmmsg call (default 32, at most %d)\n"
+		"  -G  UDP GSO segments per message (default 1, no GSO)\n"
+		"  -n  packets to send, 0 for no limit\n"
+		"  -U  send through io_uring, one submission per batch\n",
+		prog, MUL_ADDR, (int)sizeof(struct test_hdr), MAX_BATCH);
+	exit(-1);
+}
+
+/*
+ * sendmmsg() through io_uring: one sendmsg entry per message, all
+ * submitted and reaped with a single io_uring_enter(). The entries are
+ * linked so a failure cancels the rest of the batch, which keeps what
+ * went out a prefix and lets the caller hand back sequence numbers the
+ * same way. A batch longer than the room left in the queue is cut short
+ * the same way. Returns how many messages went, or -1 with errno set if
+ * the first one failed.
+ */
+static int uring_sendmmsg(struct uring *r, int s, struct mmsghdr *msgs, int m)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int i, sent, err = 0, done;
+
+	for (i = 0; i < m; i++) {
+		sqe = uring_sqe(r);
+		if (sqe == NULL && i == 0) {
+			/* Whatever is still queued goes first */
+			if (uring_submit(r, 0, 0) < 0)
+				return -1;
+			sqe = uring_sqe(r);
+		}
+		if (sqe == NULL) {
+			if (i == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			/* Send what fits; the rest is handed back like a failure */
+			r->sqes[(r->sqe_tail - 1) & *r->sq_mask].flags &= ~IOSQE_IO_LINK;
+			m = i;
+			break;
+		}
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = s;
+		sqe->addr = (uint64_t)(uintptr_t)&msgs[i].msg_hdr;
+		sqe->len = 1;
+		sqe->user_data = i;
+		if (i < m - 1)
+			sqe->flags = IOSQE_IO_LINK;
+	}
+	sent = m;
+	if (uring_submit(r, m, 0) < 0)
+		return -1;
+	for (done = 0; done < m; ) {
+		cqe = uring_cqe(r);
+		if (cqe == NULL) {
+			if (uring_submit(r, m - done, 0) < 0 && errno != EINTR)
+				return -1;
+			continue;
+		}
+		if (cqe->res < 0 && (int)cqe->user_data < sent) {
+			sent = cqe->user_data;
+			err = -cqe->res;
+		}
+		uring_cqe_seen(r);
+		done++;
+	}
+	if (sent == 0) {
+		errno = err;
+		return -1;
+	}
+	return sent;
+}
+
+static void send_loop(int s, struct opts *o, struct in_addr *grp, int ngrp)
+{
+	static struct sockaddr_in dst[MAX_GROUPS];
+	static uint64_t seq[MAX_GROUPS];
+	static struct mmsghdr msgs[MAX_BATCH];
+	static struct iovec iov[MAX_BATCH];
+	static int nseg[MAX_BATCH];
+	struct uring ring;
+	char *bufs;
+	size_t msglen = (size_t)o->size * o->segs;
+	uint64_t start, last, now;
+	long long sent = 0, drops = 0, last_sent = 0;
+	int g = 0, i, j;
+
+	bufs = calloc(o->batch, msglen);
+	if (bufs == NULL) {
+		perror("calloc");
+		exit(-1);
+	}
+	for (i = 0; i < ngrp; i++) {
+		memset(&dst[i], 0, sizeof(dst[i]));
+		dst[i].sin_family = AF_INET;
+		dst[i].sin_addr = grp[i];
+		dst[i].sin_port = htons(o->port);
+	}
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < o->batch; i++) {
+		iov[i].iov_base = bufs + i * msglen;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	if (o->uring && uring_init(&ring, o->batch, 0) < 0) {
+		perror("io_uring_setup");
+		exit(-1);
+	}
+
+	start = last = now_ns();
+	while (!stop && (o->count == 0 || sent < o->count)) {
+		long long want = (long long)o->batch * o->segs;
+		int m, r;
+
+		now = now_ns();
+		if (o->rate) {
+			long long due = (long long)((now - start) * (double)o->rate / 1e9) - sent;
+			if (due <= 0) {
+				/* Sleep off long gaps, spin through short ones */
+				uint64_t gap = 1000000000ULL / o->rate;
+				if (gap > 200000) {
+					struct timespec ts = { 0, gap / 2 };
+					nanosleep(&ts, NULL);
+				}
+				continue;
+			}
+			if (due < want)
+				want = due;
+		}
+		if (o->count && o->count - sent < want)
+			want = o->count - sent;
+
+		/*
+		 * Lay out the batch: each message carries up to segs packets to
+		 * one group. Stamp each message as we go so a large batch doesn't
+		 * make its tail look slow.
+		 */
+		for (m = 0; want > 0; m++) {
+			int k = want < o->segs ? want : o->segs;
+			char *p = iov[m].iov_base;
+
+			now = now_ns();
+			for (j = 0; j < k; j++, p += o->size) {
+				struct test_hdr *h = (struct test_hdr *)p;
+				h->magic = TEST_MAGIC;
+				h->group = g;
+				h->seq = seq[g]++;
+				h->tx_ns = now;
+			}
+			iov[m].iov_len = (size_t)k * o->size;
+			msgs[m].msg_hdr.msg_name = &dst[g];
+			nseg[m] = k;
+			want -= k;
+			g = (g + 1) % ngrp;
+		}
+
+		if (o->uring)
+			r = uring_sendmmsg(&ring, s, msgs, m);
+		else
+			r = sendmmsg(s, msgs, m, 0);
+		if (r < 0) {
+			if (errno != EAGAIN && errno != ENOBUFS && errno != EINTR) {
+				perror(o->uring ? "io_uring sendmsg error" : "sendmmsg error");
+				exit(-1);
+			}
+			r = 0;
+		}
+		for (i = 0; i < r; i++)
+			sent += nseg[i];
+		/* Hand back the sequence numbers of what did not go, newest first */
+		for (i = m - 1; i >= r; i--) {
+			struct test_hdr *h = (struct test_hdr *)iov[i].iov_base;
+			seq[h->group] -= nseg[i];
+			drops += nseg[i];
+		}
+
+		if (now - last >= 1000000000ULL) {
+			double secs = (now - last) / 1e9;
+			fprintf(stderr, "tx %.0f pps %.1f Mbit/s, %lld retried\n",
+				(sent - last_sent) / secs,
+				(sent - last_sent) * 8.0 * o->size / secs / 1e6, drops);
+			last = now;
+			last_sent = sent;
+			drops = 0;
+		}
+	}
+	now = now_ns();
+	fprintf(stderr, "sent %lld packets in %.3f s (%.0f pps)\n",
+		sent, (now - start) / 1e9, sent / ((now - start) / 1e9));
+	if (o->uring)
+		uring_exit(&ring);
+	free(bufs);
+}
+
 int main(int argc, char **argv)
 {
 	int s;
 	struct sockaddr_in saddr;
+	struct opts o;
+	static struct in_addr grp[MAX_GROUPS];
+	int ngrp, c;
+
+	memset(&o, 0, sizeof(o));
+	o.groups = MUL_ADDR;
+	o.port = MUL_PORT;
+	o.size = 64;
+	o.batch = 32;
+	o.segs = 1;
+	o.ttl = 1;
+	while ((c = getopt(argc, argv, "g:N:p:r:s:b:G:n:I:t:Uh")) != -1) {
+		switch (c) {
+		case 'g': o.groups = optarg; break;
+		case 'N': o.ngroups = atoi(optarg); break;
+		case 'p': o.port = atoi(optarg); break;
+		case 'r': o.rate = atol(optarg); break;
+		case 's': o.size = atoi(optarg); break;
+		case 'b': o.batch = atoi(optarg); break;
+		case 'G': o.segs = atoi(optarg); break;
+		case 'n': o.count = atoll(optarg); break;
+		case 'I': o.ifaddr = optarg; break;
+		case 't': o.ttl = atoi(optarg); break;
+		case 'U': o.uring = 1; break;
+		default: usage(argv[0]);
+		}
+	}
 
 	s = socket(AF_INET, SOCK_DGRAM, 0);
 	if (-1 == s) {
@@ -24,24 +296,57 @@ int main(int argc, char **argv)
 		exit(-1);
 	}
 
-	memset(&saddr, 0, sizeof(saddr));
-	saddr.sin_family = AF_INET;
-	saddr.sin_addr.s_addr = inet_addr(MUL_ADDR);
-	saddr.sin_port = htons(MUL_PORT);
+	if (argc == 1) {
+		memset(&saddr, 0, sizeof(saddr));
+		saddr.sin_family = AF_INET;
+		saddr.sin_addr.s_addr = inet_addr(MUL_ADDR);
+		saddr.sin_port = htons(MUL_PORT);
 
-	while (1)
-	{
-		int n;
-		n = sendto(s, buf, strlen(buf), 0, (struct sockaddr*)&saddr, sizeof(saddr));
-		if (n < 0) {
-			perror("sendto error");
-			exit(-1);
+		while (1)
+		{
+			int n;
+			n = sendto(s, buf, strlen(buf), 0, (struct sockaddr*)&saddr, sizeof(saddr));
+			if (n < 0) {
+				perror("sendto error");
+				exit(-1);
+			}
+
+			sleep(WAIT_TIME);
 		}
+	}
 
-		sleep(WAIT_TIME);
+	ngrp = parse_groups(o.groups, o.ngroups, grp, MAX_GROUPS);
+	if (ngrp <= 0) {
+		fprintf(stderr, "bad group list %s\n", o.groups);
+		exit(-1);
 	}
+	if (o.size < (int)sizeof(struct test_hdr) || o.batch < 1 || o.batch > MAX_BATCH ||
+	    o.segs < 1 || o.segs > MAX_SEGS || (long)o.size * o.segs > MAX_DGRAM ||
+	    o.rate < 0 || o.count < 0 || o.port < 1 || o.port > 65535)
+		usage(argv[0]);
+
+	unsigned char ttl = o.ttl;
+	setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	if (o.ifaddr != NULL) {
+		struct in_addr ifa;
+		ifa.s_addr = inet_addr(o.ifaddr);
+		if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, &ifa, sizeof(ifa)) < 0) {
+			perror("setsockopt IP_MULTICAST_IF");
+			exit(-1);
+		}
+	}
+	if (o.segs > 1) {
+		int gso = o.size;
+		if (setsockopt(s, SOL_UDP, UDP_SEGMENT, &gso, sizeof(gso)) < 0) {
+			perror("setsockopt UDP_SEGMENT");
+			exit(-1);
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	send_loop(s, &o, grp, ngrp);
 
 	close(s);
 	return 0;
 }
-
@@ -0,0 +1,60 @@
+/*
+ * Payload and helpers shared by the load test modes of igmp_server and
+ * igmp_clent. Both ends run on the same host, or on hosts with synced
+ * clocks, so fields are in host byte order and times are CLOCK_REALTIME.
+ */
+#ifndef IGMP_TEST_H
+#define IGMP_TEST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define   TEST_MAGIC   0x49474d50	/* "IGMP" */
+#define   MAX_GROUPS   1024
+
+struct test_hdr
+{
+	uint32_t magic;
+	uint32_t group;		/* index in the sender's group list */
+	uint64_t seq;		/* per group, counting from 0 */
+	uint64_t tx_ns;		/* when the sender filled it in */
+};
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * "a,b,c" gives those groups; if count is larger the list is extended
+ * with the addresses following the last one. Returns how many groups
+ * went into out, or -1 on a bad address.
+ */
+static int parse_groups(const char *spec, int count, struct in_addr *out, int max)
+{
+	char *copy = strdup(spec), *p, *save = NULL;
+	int n = 0;
+
+	for (p = strtok_r(copy, ",", &save); p != NULL && n < max; p = strtok_r(NULL, ",", &save)) {
+		if (inet_aton(p, &out[n]) == 0 || !IN_MULTICAST(ntohl(out[n].s_addr))) {
+			free(copy);
+			return -1;
+		}
+		n++;
+	}
+	free(copy);
+	while (n > 0 && n < count && n < max) {
+		out[n].s_addr = htonl(ntohl(out[n - 1].s_addr) + 1);
+		n++;
+	}
+	return n;
+}
+
+#endif
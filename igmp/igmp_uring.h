@@ -0,0 +1,214 @@
+/*
+ * Just enough io_uring for the -U modes of igmp_server and igmp_clent,
+ * straight on the system calls so that liburing isn't needed. One ring
+ * per thread, used by that thread only.
+ */
+#ifndef IGMP_URING_H
+#define IGMP_URING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring
+{
+	int fd;
+	unsigned entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned sqe_tail;	/* queued by us, not yet published */
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+};
+
+static inline int uring_init(struct uring *r, unsigned entries, unsigned cq_entries)
+{
+	struct io_uring_params p;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	if (cq_entries) {
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+	}
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+	r->entries = p.sq_entries;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		return -1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ptr = r->sq_ptr;
+	else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			return -1;
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -1;
+
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+	r->sqe_tail = *r->sq_tail;
+	return 0;
+}
+
+/* A cleared submission entry, or NULL if the queue is full */
+static inline struct io_uring_sqe *uring_sqe(struct uring *r)
+{
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (r->sqe_tail - head >= r->entries)
+		return NULL;
+	sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+	r->sq_array[r->sqe_tail & *r->sq_mask] = r->sqe_tail & *r->sq_mask;
+	r->sqe_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/*
+ * Hand the queued entries to the kernel and wait for at least wait_nr
+ * completions, giving up after timeout_ns if that isn't 0.
+ */
+static inline int uring_submit(struct uring *r, unsigned wait_nr, uint64_t timeout_ns)
+{
+	unsigned submit = r->sqe_tail - *r->sq_tail;
+	unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void *argp = NULL;
+	size_t argsz = 0;
+
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+	if (wait_nr && timeout_ns) {
+		ts.tv_sec = timeout_ns / 1000000000ULL;
+		ts.tv_nsec = timeout_ns % 1000000000ULL;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argsz = sizeof(arg);
+	}
+	return syscall(__NR_io_uring_enter, r->fd, submit, wait_nr, flags, argp, argsz);
+}
+
+/* The next completion, or NULL; uring_cqe_seen() once done with it */
+static inline struct io_uring_cqe *uring_cqe(struct uring *r)
+{
+	unsigned head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *r)
+{
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void uring_exit(struct uring *r)
+{
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+/*
+ * Provided buffer ring: the kernel picks a buffer from it for each
+ * datagram, we give buffers back once read. entries must be a power of
+ * two.
+ */
+struct uring_bufs
+{
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	unsigned entries;
+	unsigned short tail;
+	int bgid;
+	char *base;
+	unsigned size;		/* bytes per buffer */
+};
+
+static inline void uring_buf_put(struct uring_bufs *b, unsigned short bid)
+{
+	struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->entries - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(b->base + (size_t)bid * b->size);
+	buf->len = b->size;
+	buf->bid = bid;
+	b->tail++;
+}
+
+static inline void uring_buf_publish(struct uring_bufs *b)
+{
+	__atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+static inline int uring_bufs_init(struct uring *r, struct uring_bufs *b, int bgid, unsigned entries, unsigned size)
+{
+	struct io_uring_buf_reg reg;
+	unsigned i;
+
+	memset(b, 0, sizeof(*b));
+	b->entries = entries;
+	b->size = size;
+	b->bgid = bgid;
+	b->br_size = entries * sizeof(struct io_uring_buf);
+	b->br = mmap(NULL, b->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b->br == MAP_FAILED)
+		return -1;
+	b->base = malloc((size_t)entries * size);
+	if (b->base == NULL)
+		return -1;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)b->br;
+	reg.ring_entries = entries;
+	reg.bgid = bgid;
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return -1;
+	for (i = 0; i < entries; i++)
+		uring_buf_put(b, i);
+	uring_buf_publish(b);
+	return 0;
+}
+
+static inline void uring_bufs_free(struct uring_bufs *b)
+{
+	munmap(b->br, b->br_size);
+	free(b->base);
+}
+
+#endif